@@ -23,7 +23,8 @@
 /*** Show how the ADC ports are used in Linux on Vybrid architecture.      ***/
 /***                                                                       ***/
 /*** Compile with:                                                         ***/
-/***              arm-linux-gcc -o adc adc.c                               ***/
+/***              arm-linux-gcc -o adc adc.c -lm                           ***/
+/*** Add -mfpu=neon to use the NEON versions of the filter kernels.        ***/
 /***                                                                       ***/
 /*****************************************************************************/
 /*** THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY ***/
@@ -38,6 +39,19 @@
 #include <fcntl.h>			/* open(), O_RDWR */
 #include <unistd.h>			/* write(), close(), sleep() */
 #include <sys/ioctl.h>			/* ioctl(), _IO(), _IOWR() */
+#include <getopt.h>			/* getopt() */
+#include <time.h>			/* clock_gettime() */
+#include <math.h>			/* sqrt(), isfinite() */
+#include <stdint.h>			/* uint64_t */
+#include <errno.h>			/* EINTR */
+#include <sched.h>			/* sched_setscheduler() */
+#include <sys/mman.h>			/* mlockall(), mmap() */
+#include <sys/stat.h>			/* fstat() */
+#include <sys/sysmacros.h>		/* minor() */
+#include <signal.h>			/* sigaction() */
+#ifdef __ARM_NEON
+#include <arm_neon.h>			/* NEON intrinsics */
+#endif
 #include "mvf_adc.h"			/* struct adc_feature, ... */
 
 /* Default values */
@@ -45,17 +59,2203 @@
 #define DEFAULT_SAMPLES 1
 #define DEFAULT_DELAY 1
 
+/* Maximum number of channels in a scan list (ADC0..ADC15) */
+#define MAX_CHANNELS 16
+
+/* Highest sample or trigger rate of -r, one sample per ns */
+#define MAX_RATE 1e9
+
+/* Software filters: fractional bits of the fixed point values, samples
+   per processing block and the limits of the filter stages */
+#define DSP_FRAC_BITS 4
+#define DSP_BLOCK 256
+#define MAX_TAPS 64
+#define MAX_AVG 256
+#define MAX_DEC 1024
+#define MAX_ORDER 3
+#define BENCH_ROUNDS 2000
+
+/* Largest sum of |h| of the FIR, so that sum |h| * 4095 plus rounding
+   still fits into the int32_t accumulator (a gain of about 16) */
+#define MAX_TAP_SUM ((INT32_MAX - (1 << 14)) / 4095)
+
+/* Raw output and shared memory ring */
+#define RAW_MAGIC 0x52434441		/* "ADCR" */
+#define RING_MAGIC 0x47524441		/* "ADRG" */
+#define DEFAULT_RING_KB 1024
+#define MAX_RING_KB (1024 * 1024)
+
+/* Registers of the ADCs for the compare values (Vybrid memory map) */
+#define ADC0_BASE 0x4003B000
+#define ADC1_BASE 0x400BB000
+#define ADC_REGS_SIZE 0x1000
+#define ADC_MAX_VALUE 4095
+
+/* Calibration: values in 1/CAL_SCALE units, points of a sensor curve */
+#define CAL_SCALE 1000
+#define MAX_POINTS 16
+
+/* Configuration sweep: discarded conversions after each reconfiguration */
+#define SWEEP_WARMUP 4
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Block acquisition: limit of the block size and the trigger rate and
+   signal (ramp plus noise) of the simulation */
+#define MAX_BLOCK_SCANS 65536
+#define SIM_RATE 100000
+#define SIM_BASE 1024
+#define SIM_SPAN 2048
+#define SIM_NOISE 7
+
 char device_path[] = "/dev/mvf-adc.?";
 
-/* ADC specific information */
-struct adc_feature testfeature = {
-	.channel = ADC8,
-	.clk_sel = ADCIOC_ADACK_SET,
-	.clk_div_num = CLK_DIV2,
-	.res_mode = BIT12,
+/* Command line options */
+static int stream;			/* continuous conversion, no delay */
+static int quiet;			/* do not print the samples */
+static double rate;			/* samples/s on a fixed grid, 0: off */
+static int rt_prio;			/* SCHED_FIFO priority, 0: off */
+static int lock_mem;			/* mlockall() */
+static unsigned int channels[MAX_CHANNELS];	/* scan list */
+static unsigned int nchannels;
+static int16_t taps[MAX_TAPS];		/* FIR, reversed, Q15 */
+static unsigned int ntaps;		/* multiple of 4, 0: no FIR */
+static unsigned int avg_len;		/* moving average, 0: off */
+static unsigned int dec;		/* decimation factor, 0: off */
+static unsigned int dec_order = 1;	/* 1: boxcar, 2..3: CIC */
+static unsigned int bench;		/* values per benchmark setting */
+static FILE *raw_out;			/* raw output (-o), NULL: off */
+static FILE *info;			/* messages, stderr if raw to stdout */
+static int watch_on;			/* watch mode (-w) */
+static char *hook;			/* command for each crossing (-x) */
+static volatile sig_atomic_t stopped;	/* SIGINT/SIGTERM in watch mode */
+static unsigned int adc_bits = 12;	/* resolution (-b) */
+static int cal_on;			/* calibration file (-C) */
+static unsigned long window_n;		/* samples per window (-W) */
+static unsigned long window_ms;		/* or duration of a window */
+static unsigned int sweep;		/* conversions per configuration */
+static unsigned int block_scans;	/* block acquisition (-D) */
+static int simulated;			/* device "sim", no hardware */
+
+/* Running statistics (Welford) of the sample intervals or the wakeup
+   lateness in ns, or of sample values */
+struct interval_stats {
+	unsigned long count;
+	uint64_t min;
+	uint64_t max;
+	double mean;
+	double m2;			/* sum of squared deviations */
+};
+
+/* Software filter state of one channel */
+struct dsp {
+	int16_t fir_in[MAX_TAPS - 1 + DSP_BLOCK];	/* history + block */
+	int32_t work[DSP_BLOCK];
+	int32_t avg_ring[MAX_AVG];
+	int64_t avg_sum;
+	unsigned int avg_pos;
+	unsigned int avg_fill;
+	unsigned int phase;		/* inputs of the current output */
+	int64_t acc;			/* integrate and dump */
+	uint64_t integ[MAX_ORDER];	/* CIC, wrap modulo 2^64 */
+	uint64_t comb[MAX_ORDER];
+};
+
+static struct dsp dsp[MAX_CHANNELS];
+
+/* Header in front of each block of raw samples. The block holds nscans
+   scans of nchannels uint16_t values in scan list order. Vybrid (and x86)
+   are little endian, so everything is written as it is in memory. */
+struct raw_header {
+	uint32_t magic;			/* RAW_MAGIC */
+	uint16_t nchannels;		/* values per scan */
+	uint16_t nscans;		/* scans in this block */
+	uint64_t time_ns;		/* CLOCK_MONOTONIC of the first scan */
+};
+
+/* Shared memory ring in /dev/shm with one producer (this program) and one
+   consumer. head and tail count bytes and run freely, the offset in data[]
+   is head & (size - 1). The producer only writes head and drops, the
+   consumer only writes tail; data[] holds whole raw blocks (header and
+   samples), a block may wrap at the end of data[]. */
+struct shm_ring {
+	uint32_t magic;			/* RING_MAGIC when ready */
+	uint32_t size;			/* bytes in data[], power of 2 */
+	uint32_t nchannels;		/* scan list */
+	uint32_t channels[MAX_CHANNELS];
+	uint32_t drops;			/* blocks dropped, ring full */
+	uint32_t head __attribute__((aligned(64)));	/* bytes written */
+	uint32_t tail __attribute__((aligned(64)));	/* bytes read */
+	uint8_t data[] __attribute__((aligned(64)));
+};
+
+static struct shm_ring *ring;		/* -R, NULL: off */
+
+/* Condition of the hardware compare function: without range, the result
+   is < cv1 (greater = 0) or >= cv1 (greater = 1); with range, it is
+   outside cv1..cv2 exclusive (greater = 0) or inside inclusive (1) */
+struct watch {
+	int greater;			/* ACFGT */
+	int range;			/* ACREN */
+	unsigned int cv1;
+	unsigned int cv2;
+};
+
+static struct watch watch_cond;		/* alarm condition */
+
+/* Calibration of one channel */
+struct cal {
+	double offset;			/* mV, subtracted */
+	double gain;
+	double vref;			/* mV at full scale, 0: raw LSB */
+	char unit[16];
+	unsigned int npoints;		/* sensor curve, 0: mV */
+	double mv[MAX_POINTS];
+	double value[MAX_POINTS];
+	int32_t lut[(ADC_MAX_VALUE + 1) + 1];	/* by raw code */
+};
+
+static struct cal cal[MAX_CHANNELS];	/* by channel number */
+
+/* Statistics of one channel over one window */
+struct window {
+	struct interval_stats st;
+	uint32_t hist[ADC_MAX_VALUE + 1];	/* samples per raw code */
+};
+
+static struct window win[MAX_CHANNELS];
+
+/* Settings of the configuration sweep. The sample time is given in ADC
+   clock cycles, as set by ADLSMP (long sample) and ADSTS in ADC_CFG. */
+static const struct {
+	int value;
+	unsigned int bits;
+} sweep_bits[] = {
+	{BIT8, 8}, {BIT10, 10}, {BIT12, 12},
+};
+
+static const struct {
+	int value;
+	const char *name;
+} sweep_clk[] = {
+	{ADCIOC_BUSCLK_SET, "bus"},
+	{ADCIOC_ALTCLK_SET, "alt"},
+	{ADCIOC_ADACK_SET, "adack"},
+}, sweep_div[] = {
+	{CLK_DIV2, "2"}, {CLK_DIV4, "4"}, {CLK_DIV8, "8"},
+}, sweep_sam[] = {
+	{0, "2"},
+	{ADSTS_SHORT, "4"},
+	{ADSTS_NORMAL, "6"},
+	{ADSTS_LONG, "8"},
+	{ADLSMP_LONG, "12"},
+	{ADLSMP_LONG | ADSTS_SHORT, "16"},
+	{ADLSMP_LONG | ADSTS_NORMAL, "20"},
+	{ADLSMP_LONG | ADSTS_LONG, "24"},
+};
+
+/* Resolutions * clocks * dividers * sample times * hs_oper * lp_con */
+#define SWEEP_CONFIGS (3 * 3 * 3 * 8 * 2 * 2)
+
+/* Source of the blocks of -D. A DMA backend would enable DMA and the
+   hardware trigger in start() and switch them off again in stop() */
+struct block_backend {
+	const char *name;
+	int (*start)(void);
+	int (*read)(uint16_t *buf, unsigned int scans);
+	void (*stop)(void);		/* NULL: nothing to undo */
+	unsigned long (*overruns)(void);
+};
+
+/* State of the simulated block acquisition */
+static struct {
+	uint64_t period;		/* ns per scan (trigger) */
+	uint64_t next;			/* time of the next block */
+	unsigned long long index;	/* scans so far */
+	unsigned long overruns;		/* blocks lost, caller too late */
+	uint32_t seed;			/* noise */
+} sim;
+
+/* Result of one configuration of the sweep */
+struct sweep_result {
+	unsigned int bits;		/* indexes into the tables above */
+	unsigned int clk;
+	unsigned int div;
+	unsigned int sam;
+	int hs;
+	int lp;
+	double rate;			/* conversions/s */
+	double lat_mean;		/* us */
+	double lat_max;
+	double noise;			/* stddev in LSB */
+	double noise12;			/* stddev in 12 bit LSB */
+};
+
+/* ADC specific information */
+struct adc_feature testfeature = {
+	.channel = ADC8,
+	.clk_sel = ADCIOC_ADACK_SET,
+	.clk_div_num = CLK_DIV2,
+	.res_mode = BIT12,
+};
+
+
+/*****************************************************************************
+*** Function:    uint64_t now_ns(void)                                     ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      Current CLOCK_MONOTONIC time in nanoseconds               ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Time base for the sample timing.                                       ***
+*****************************************************************************/
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*****************************************************************************
+*** Function:    void interval_add(struct interval_stats *st,              ***
+***                                uint64_t interval)                      ***
+***                                                                        ***
+*** Parameters:  st:       interval statistics                             ***
+***              interval: time since the previous sample in ns            ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Add an interval to min, max, mean and variance. The variance is        ***
+*** updated incrementally, so no samples have to be stored.                ***
+*****************************************************************************/
+static void interval_add(struct interval_stats *st, uint64_t interval)
+{
+	double delta;
+
+	if (!st->count || (interval < st->min))
+		st->min = interval;
+	if (interval > st->max)
+		st->max = interval;
+	st->count++;
+	delta = interval - st->mean;
+	st->mean += delta / st->count;
+	st->m2 += delta * (interval - st->mean);
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_channels(char *list)                            ***
+***                                                                        ***
+*** Parameters:  list: channel or scan list, e.g. "0,3,8-11"               ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Fill the scan list with single channels and ranges of channels. The    ***
+*** channels are converted in the given order.                             ***
+*****************************************************************************/
+static int parse_channels(char *list)
+{
+	unsigned long first, last;
+	char *end;
+
+	nchannels = 0;
+	for (;;) {
+		first = strtoul(list, &end, 0);
+		if (end == list)
+			return 1;
+		last = first;
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 0);
+		if ((last < first) || (last > ADC15))
+			return 1;
+		while (first <= last) {
+			if (nchannels >= MAX_CHANNELS)
+				return 1;
+			channels[nchannels++] = first++;
+		}
+		if (*end != ',')
+			break;
+		list = end + 1;
+	}
+
+	return *end != '\0';
+}
+
+
+/*****************************************************************************
+*** Function:    int convert_channel(int fd, unsigned int channel)         ***
+***                                                                        ***
+*** Parameters:  fd:      file descriptor of the ADC device                ***
+***              channel: channel to convert                               ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Convert one channel, the result is in testfeature.result0. Switching   ***
+*** channels only needs a new client registration; the ADC keeps its       ***
+*** configuration. When streaming a single channel, the client is          ***
+*** registered once before the loop and each sample is one ADC_CONVERT.    ***
+*****************************************************************************/
+static int convert_channel(int fd, unsigned int channel)
+{
+	if (!stream || (nchannels > 1)) {
+		testfeature.channel = (enum adc_channel)channel;
+		if (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1) {
+			perror("Can not register client");
+			return 1;
+		}
+	}
+	if (ioctl(fd, ADC_CONVERT, &testfeature) == -1) {
+		perror("can not convert ADC value");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_taps(char *list)                                ***
+***                                                                        ***
+*** Parameters:  list: comma separated FIR coefficients h[0],h[1],...      ***
+***                    (Q15)                                               ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Store the FIR coefficients reversed and padded with leading zeros to a ***
+*** multiple of 4, so that y[i] = sum t[m] * x[i + m] over the block with  ***
+*** its history and the vector kernel needs no tail handling. The sum of   ***
+*** |h| is limited to MAX_TAP_SUM, so the 32 bit accumulators of the       ***
+*** kernels can not overflow for any samples.                              ***
+*****************************************************************************/
+static int parse_taps(char *list)
+{
+	long h[MAX_TAPS];
+	long sum = 0;
+	unsigned int n = 0, m;
+	char *end;
+
+	for (;;) {
+		if (n >= MAX_TAPS)
+			return 1;
+		h[n] = strtol(list, &end, 0);
+		if ((end == list) || (h[n] < -32768) || (h[n] > 32767))
+			return 1;
+		sum += labs(h[n]);
+		n++;
+		if (*end != ',')
+			break;
+		list = end + 1;
+	}
+	if (*end)
+		return 1;
+	if (sum > MAX_TAP_SUM) {
+		fprintf(stderr, "Sum of |h| is %ld, at most %ld is allowed\n",
+			sum, (long)MAX_TAP_SUM);
+		return 1;
+	}
+
+	ntaps = (n + 3) & ~3;
+	memset(taps, 0, sizeof(taps));
+	for (m = 0; m < n; m++)
+		taps[ntaps - 1 - m] = h[m];
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void fir_c(const int16_t *in, int32_t *out,               ***
+***                         unsigned int n)                                ***
+***                                                                        ***
+*** Parameters:  in:  ntaps - 1 history samples followed by n new samples  ***
+***              out: n filtered values (Q4)                               ***
+***              n:   number of new samples                                ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** FIR filter, plain C. Q15 coefficients times integer samples give a Q15 ***
+*** sum that is rounded to DSP_FRAC_BITS fractional bits.                  ***
+*****************************************************************************/
+static void fir_c(const int16_t *in, int32_t *out, unsigned int n)
+{
+	unsigned int i, k;
+	int32_t acc;
+
+	for (i = 0; i < n; i++) {
+		acc = 0;
+		for (k = 0; k < ntaps; k++)
+			acc += taps[k] * in[i + k];
+		out[i] = (acc + (1 << (14 - DSP_FRAC_BITS)))
+			>> (15 - DSP_FRAC_BITS);
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    int64_t sum_c(const int32_t *in, unsigned int n)          ***
+***                                                                        ***
+*** Parameters:  in: values                                                ***
+***              n:  number of values                                      ***
+***                                                                        ***
+*** Return:      Sum of the values                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Integrate part of the integrate-and-dump decimator, plain C.           ***
+*****************************************************************************/
+static int64_t sum_c(const int32_t *in, unsigned int n)
+{
+	int64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += in[i];
+
+	return sum;
+}
+
+
+#ifdef __ARM_NEON
+/*****************************************************************************
+*** Function:    void fir_neon(const int16_t *in, int32_t *out,            ***
+***                            unsigned int n)                             ***
+***                                                                        ***
+*** Parameters:  see fir_c()                                               ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** FIR filter with NEON: four 16x16 bit products are accumulated into 32  ***
+*** bit lanes per instruction, the lanes are added at the end.             ***
+*****************************************************************************/
+static void fir_neon(const int16_t *in, int32_t *out, unsigned int n)
+{
+	int32x4_t acc;
+	int32x2_t sum;
+	unsigned int i, k;
+
+	for (i = 0; i < n; i++) {
+		acc = vdupq_n_s32(0);
+		for (k = 0; k < ntaps; k += 4)
+			acc = vmlal_s16(acc, vld1_s16(in + i + k),
+					vld1_s16(taps + k));
+		sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+		sum = vpadd_s32(sum, sum);
+		out[i] = (vget_lane_s32(sum, 0) + (1 << (14 - DSP_FRAC_BITS)))
+			>> (15 - DSP_FRAC_BITS);
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    int64_t sum_neon(const int32_t *in, unsigned int n)       ***
+***                                                                        ***
+*** Parameters:  see sum_c()                                               ***
+***                                                                        ***
+*** Return:      Sum of the values                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Integrate with NEON: pairs of 32 bit lanes are added into two 64 bit   ***
+*** lanes, four values per instruction.                                    ***
+*****************************************************************************/
+static int64_t sum_neon(const int32_t *in, unsigned int n)
+{
+	int64x2_t acc = vdupq_n_s64(0);
+	int64_t sum;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		acc = vpadalq_s32(acc, vld1q_s32(in + i));
+	sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+	for (; i < n; i++)
+		sum += in[i];
+
+	return sum;
+}
+
+#define dsp_fir fir_neon
+#define dsp_sum sum_neon
+#else
+#define dsp_fir fir_c
+#define dsp_sum sum_c
+#endif
+
+
+/*****************************************************************************
+*** Function:    unsigned int dsp_run(struct dsp *d, const uint16_t *raw,  ***
+***                                   unsigned int n, int32_t *out)        ***
+***                                                                        ***
+*** Parameters:  d:   filter state of one channel                          ***
+***              raw: block of raw samples                                 ***
+***              n:   number of samples, at most DSP_BLOCK                 ***
+***              out: output values (Q4)                                   ***
+***                                                                        ***
+*** Return:      Number of output values                                   ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Run a block of samples through the software stages that are enabled:   ***
+*** FIR filter (-f), moving average (-a) and decimator (-d). The values    ***
+*** are fixed point with DSP_FRAC_BITS fractional bits, so averaging and   ***
+*** decimation can gain resolution below one LSB. The decimator of order 1 ***
+*** is a boxcar integrate-and-dump (oversample and decimate), higher       ***
+*** orders are CIC filters with a gain of dec^order that is divided out.   ***
+*****************************************************************************/
+static unsigned int dsp_run(struct dsp *d, const uint16_t *raw,
+			    unsigned int n, int32_t *out)
+{
+	int32_t *x = d->work;
+	int64_t gain;
+	uint64_t v, tmp;
+	unsigned int i, c, take, m = 0;
+
+	/* FIR, the history of ntaps - 1 samples is kept in front */
+	if (ntaps) {
+		for (i = 0; i < n; i++)
+			d->fir_in[ntaps - 1 + i] = raw[i];
+		dsp_fir(d->fir_in, x, n);
+		memmove(d->fir_in, d->fir_in + n,
+			(ntaps - 1) * sizeof(d->fir_in[0]));
+	} else {
+		for (i = 0; i < n; i++)
+			x[i] = raw[i] << DSP_FRAC_BITS;
+	}
+
+	/* Moving average over the last avg_len values */
+	if (avg_len) {
+		for (i = 0; i < n; i++) {
+			d->avg_sum += x[i] - d->avg_ring[d->avg_pos];
+			d->avg_ring[d->avg_pos] = x[i];
+			d->avg_pos = (d->avg_pos + 1) % avg_len;
+			if (d->avg_fill < avg_len)
+				d->avg_fill++;
+			x[i] = (d->avg_sum + d->avg_fill / 2) / d->avg_fill;
+		}
+	}
+
+	if (!dec) {
+		memcpy(out, x, n * sizeof(x[0]));
+		return n;
+	}
+
+	/* Integrate and dump */
+	if (dec_order == 1) {
+		for (i = 0; i < n; i += take) {
+			take = dec - d->phase;
+			if (take > n - i)
+				take = n - i;
+			d->acc += dsp_sum(x + i, take);
+			d->phase += take;
+			if (d->phase == dec) {
+				out[m++] = (d->acc + dec / 2) / dec;
+				d->acc = 0;
+				d->phase = 0;
+			}
+		}
+		return m;
+	}
+
+	/* CIC: integrators at the input rate, combs at the output rate. The
+	   integrators wrap after a while, which is defined for unsigned values
+	   and cancels out in the combs: their result is at most gain times the
+	   largest input, far below 2^63, so only that is taken as signed */
+	for (gain = 1, c = 0; c < dec_order; c++)
+		gain *= dec;
+	for (i = 0; i < n; i++) {
+		d->integ[0] += (uint64_t)x[i];
+		for (c = 1; c < dec_order; c++)
+			d->integ[c] += d->integ[c - 1];
+		if (++d->phase < dec)
+			continue;
+		d->phase = 0;
+		v = d->integ[dec_order - 1];
+		for (c = 0; c < dec_order; c++) {
+			tmp = v;
+			v -= d->comb[c];
+			d->comb[c] = tmp;
+		}
+		out[m++] = ((int64_t)v + gain / 2) / gain;
+	}
+
+	return m;
+}
+
+
+/*****************************************************************************
+*** Function:    int load_cal(const char *path)                            ***
+***                                                                        ***
+*** Parameters:  path: calibration file                                    ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Read the calibration of the channels. Each line is                     ***
+***   channel offset gain vref [unit mV:value mV:value ...]                ***
+*** with the offset in mV, the gain as factor and the reference voltage in ***
+*** mV at full scale (as selected with -V). The optional sensor curve maps ***
+*** the corrected mV to <unit> with at least two points in ascending mV    ***
+*** order. Empty lines and lines starting with # are ignored. Channels     ***
+*** that are not in the file are shown as raw LSB.                         ***
+*****************************************************************************/
+static int load_cal(const char *path)
+{
+	FILE *f;
+	struct cal *c;
+	char line[256];
+	char *tok, *end;
+	unsigned long ch;
+	unsigned int lineno = 0;
+	double *field[3];
+	int i;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror("Can not open calibration file");
+		return 1;
+	}
+	for (ch = 0; ch < MAX_CHANNELS; ch++) {
+		cal[ch].gain = 1;
+		strcpy(cal[ch].unit, "LSB");
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		tok = strtok(line, " \t\r\n");
+		if (!tok || (*tok == '#'))
+			continue;
+		ch = strtoul(tok, &end, 0);
+		if (*end || (ch > ADC15))
+			goto invalid;
+		c = &cal[ch];
+		field[0] = &c->offset;
+		field[1] = &c->gain;
+		field[2] = &c->vref;
+		for (i = 0; i < 3; i++) {
+			tok = strtok(NULL, " \t\r\n");
+			if (!tok)
+				goto invalid;
+			*field[i] = strtod(tok, &end);
+			if (*end)
+				goto invalid;
+		}
+		if (c->vref <= 0)
+			goto invalid;
+
+		strcpy(c->unit, "mV");
+		c->npoints = 0;
+		tok = strtok(NULL, " \t\r\n");
+		if (!tok)
+			continue;
+		snprintf(c->unit, sizeof(c->unit), "%s", tok);
+		while ((tok = strtok(NULL, " \t\r\n"))) {
+			if (c->npoints >= MAX_POINTS)
+				goto invalid;
+			c->mv[c->npoints] = strtod(tok, &end);
+			if (*end != ':')
+				goto invalid;
+			c->value[c->npoints] = strtod(end + 1, &end);
+			if (*end || (c->npoints
+				     && (c->mv[c->npoints]
+					 <= c->mv[c->npoints - 1])))
+				goto invalid;
+			c->npoints++;
+		}
+		if (c->npoints < 2)
+			goto invalid;
+	}
+
+	fclose(f);
+	cal_on = 1;
+
+	return 0;
+
+invalid:
+	fprintf(stderr, "%s:%u: invalid calibration\n", path, lineno);
+	fclose(f);
+
+	return 1;
+}
+
+
+/*****************************************************************************
+*** Function:    void build_cal(void)                                      ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Fill the lookup table of each channel for the active resolution, so    ***
+*** that converting a sample is a single table load. The entries are in    ***
+*** 1/CAL_SCALE units. The sensor curve is interpolated linearly between   ***
+*** its points and extended with the first and last segment beyond them.   ***
+*** The table has one entry more than there are codes, for the             ***
+*** interpolation of filter outputs between two codes.                     ***
+*****************************************************************************/
+static void build_cal(void)
+{
+	struct cal *c;
+	unsigned int ch, code, p, codes = 1 << adc_bits;
+	double v;
+
+	for (ch = 0; ch < MAX_CHANNELS; ch++) {
+		c = &cal[ch];
+		for (code = 0; code <= codes; code++) {
+			if (!c->vref) {
+				c->lut[code] = code * CAL_SCALE;
+				continue;
+			}
+			v = (code * c->vref / codes - c->offset) * c->gain;
+			if (c->npoints) {
+				for (p = 1; (p < c->npoints - 1)
+					     && (v > c->mv[p]); p++)
+					;
+				v = c->value[p - 1] + (v - c->mv[p - 1])
+					* (c->value[p] - c->value[p - 1])
+					/ (c->mv[p] - c->mv[p - 1]);
+			}
+			c->lut[code] = lround(v * CAL_SCALE);
+		}
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void cal_block(unsigned int channel, const uint16_t *raw, ***
+***                             unsigned int n, int32_t *out)              ***
+***                                                                        ***
+*** Parameters:  channel: ADC channel of the samples                       ***
+***              raw:     raw samples                                      ***
+***              n:       number of samples                                ***
+***              out:     calibrated values (1/CAL_SCALE units)            ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Convert a block of raw samples with the lookup table.                  ***
+*****************************************************************************/
+static void cal_block(unsigned int channel, const uint16_t *raw,
+		      unsigned int n, int32_t *out)
+{
+	const int32_t *lut = cal[channel].lut;
+	unsigned int i, mask = (1 << adc_bits) - 1;
+
+	for (i = 0; i < n; i++)
+		out[i] = lut[raw[i] & mask];
+}
+
+
+/*****************************************************************************
+*** Function:    void cal_filtered(unsigned int channel, int32_t *io,      ***
+***                                unsigned int n)                         ***
+***                                                                        ***
+*** Parameters:  channel: ADC channel of the values                        ***
+***              io:      filter outputs (Q4), replaced by the calibrated  ***
+***                       values (1/CAL_SCALE units)                       ***
+***              n:       number of values                                 ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Convert a block of filter outputs. They have a fractional part, so the ***
+*** two neighbouring table entries are interpolated to keep the resolution ***
+*** that the filters gained.                                               ***
+*****************************************************************************/
+static void cal_filtered(unsigned int channel, int32_t *io, unsigned int n)
+{
+	const int32_t *lut = cal[channel].lut;
+	unsigned int i, code, codes = 1 << adc_bits;
+	int32_t frac;
+
+	for (i = 0; i < n; i++) {
+		if (io[i] < 0) {
+			io[i] = lut[0];
+			continue;
+		}
+		code = io[i] >> DSP_FRAC_BITS;
+		if (code >= codes) {
+			io[i] = lut[codes];
+			continue;
+		}
+		frac = io[i] & ((1 << DSP_FRAC_BITS) - 1);
+		io[i] = lut[code] + (((int64_t)(lut[code + 1] - lut[code])
+				      * frac) >> DSP_FRAC_BITS);
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void sleep_until(uint64_t deadline)                       ***
+***                                                                        ***
+*** Parameters:  deadline: CLOCK_MONOTONIC time in ns                      ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Sleep until an absolute time. Unlike a relative sleep, the time needed ***
+*** for the conversion does not add up from sample to sample.              ***
+*****************************************************************************/
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR)
+		;
+}
+
+
+/*****************************************************************************
+*** Function:    int set_realtime(void)                                    ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Run with SCHED_FIFO priority (-p) and lock all memory (-m), so neither ***
+*** other processes nor page faults delay a sample.                        ***
+*****************************************************************************/
+static int set_realtime(void)
+{
+	struct sched_param param;
+
+	if (rt_prio) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+			perror("Can not set SCHED_FIFO");
+			return 1;
+		}
+	}
+	if (lock_mem && (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)) {
+		perror("Can not lock memory");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int open_ring(char *arg)                                  ***
+***                                                                        ***
+*** Parameters:  arg: name[:kbytes] of the ring in /dev/shm                ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Create the shared memory ring. The data size is rounded up to a power  ***
+*** of 2, so that the free running head and tail only need a mask, and to  ***
+*** at least one full block of DSP_BLOCK scans. The magic is written last, ***
+*** consumers wait for it before using the ring.                           ***
+*** The file is left in /dev/shm at exit, so a consumer can read the rest. ***
+*****************************************************************************/
+static int open_ring(char *arg)
+{
+	char path[64];
+	char *colon, *end;
+	unsigned long kbytes = DEFAULT_RING_KB;
+	uint32_t size = 4096;
+	uint32_t min;
+	int fd;
+
+	colon = strchr(arg, ':');
+	if (colon) {
+		*colon = '\0';
+		kbytes = strtoul(colon + 1, &end, 0);
+		if ((end == colon + 1) || *end)
+			kbytes = 0;
+	}
+	if (!*arg || strchr(arg, '/') || !kbytes || (kbytes > MAX_RING_KB)) {
+		fprintf(stderr, "Invalid ring '%s'\n", arg);
+		return 1;
+	}
+	/* Hold at least one full block, or every block would be dropped */
+	min = sizeof(struct raw_header) + DSP_BLOCK * nchannels * 2;
+	while ((size < kbytes * 1024) || (size < min))
+		size <<= 1;
+	snprintf(path, sizeof(path), "/dev/shm/%s", arg);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Can not create ring");
+		return 1;
+	}
+	if (ftruncate(fd, sizeof(struct shm_ring) + size)) {
+		perror("Can not size ring");
+		close(fd);
+		return 1;
+	}
+	ring = mmap(NULL, sizeof(struct shm_ring) + size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		ring = NULL;
+		perror("Can not map ring");
+		return 1;
+	}
+	ring->size = size;
+	ring->nchannels = nchannels;
+	memcpy(ring->channels, channels, sizeof(ring->channels));
+	__atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+	fprintf(info, "Ring '%s', %u bytes\n", path, size);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int write_raw(uint16_t (*blk)[DSP_BLOCK], unsigned int n, ***
+***                            uint64_t time)                              ***
+***                                                                        ***
+*** Parameters:  blk:  samples of each channel                             ***
+***              n:    number of scans                                     ***
+***              time: time of the first scan (CLOCK_MONOTONIC, ns)        ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Pack a block of scans behind a raw_header and hand it to the raw       ***
+*** output file (-o) and to the shared memory ring (-R). The ring is never ***
+*** waited for: if the consumer is too slow, the block is dropped and      ***
+*** counted. Otherwise the block is copied in, wrapping at the end, and    ***
+*** only then the head is moved on, so the consumer never sees a partial   ***
+*** block.                                                                 ***
+*****************************************************************************/
+static int write_raw(uint16_t (*blk)[DSP_BLOCK], unsigned int n,
+		     uint64_t time)
+{
+	static struct {
+		struct raw_header h;
+		uint16_t v[DSP_BLOCK * MAX_CHANNELS];
+	} out;
+	const uint8_t *p = (const uint8_t *)&out;
+	uint32_t head, tail, len, off, first;
+	unsigned int i, k;
+
+	out.h.magic = RAW_MAGIC;
+	out.h.nchannels = nchannels;
+	out.h.nscans = n;
+	out.h.time_ns = time;
+	for (i = 0; i < n; i++)
+		for (k = 0; k < nchannels; k++)
+			out.v[i * nchannels + k] = blk[k][i];
+	len = sizeof(out.h) + n * nchannels * sizeof(out.v[0]);
+
+	if (raw_out) {
+		if ((fwrite(&out, len, 1, raw_out) != 1) || fflush(raw_out)) {
+			perror("Can not write samples");
+			return 1;
+		}
+	}
+
+	if (ring) {
+		head = ring->head;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->size - (head - tail) < len) {
+			__atomic_store_n(&ring->drops, ring->drops + 1,
+					 __ATOMIC_RELAXED);
+			return 0;
+		}
+		off = head & (ring->size - 1);
+		first = ring->size - off;
+		if (first > len)
+			first = len;
+		memcpy(ring->data + off, p, first);
+		memcpy(ring->data, p + first, len - first);
+		__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void stop_run(int sig)                                    ***
+***                                                                        ***
+*** Parameters:  sig: signal number                                        ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Signal handler for SIGINT and SIGTERM, end the watch mode or an        ***
+*** endless run.                                                           ***
+*****************************************************************************/
+static void stop_run(int sig)
+{
+	(void)sig;
+	stopped = 1;
+}
+
+
+/*****************************************************************************
+*** Function:    void catch_signals(void)                                  ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Let SIGINT and SIGTERM end the run cleanly, so that the final          ***
+*** statistics are still shown. Without SA_RESTART, a blocking ioctl()     ***
+*** returns with EINTR.                                                    ***
+*****************************************************************************/
+static void catch_signals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_run;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+
+/*****************************************************************************
+*** Function:    void window_add(struct window *w, unsigned int value)     ***
+***                                                                        ***
+*** Parameters:  w:     window statistics of a channel                     ***
+***              value: raw sample                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Add a sample to the running statistics and to the histogram of the     ***
+*** window. The histogram has one counter per raw code, so the quantiles   ***
+*** are exact and the memory is fixed, however long the window or the run  ***
+*** is.                                                                    ***
+*****************************************************************************/
+static void window_add(struct window *w, unsigned int value)
+{
+	value &= ADC_MAX_VALUE;
+	interval_add(&w->st, value);
+	w->hist[value]++;
+}
+
+
+/*****************************************************************************
+*** Function:    void window_show(struct window *w, unsigned long n,       ***
+***                               double t, unsigned int k)                ***
+***                                                                        ***
+*** Parameters:  w: window statistics of a channel                         ***
+***              n: number of the window                                   ***
+***              t: time at the end of the window in seconds               ***
+***              k: index of the channel in the scan list                  ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show the summary of the window and start a new one. It goes to the     ***
+*** info stream, so it stays out of raw samples on stdout. The quantiles   ***
+*** are found in one pass over the histogram between min and max; only     ***
+*** this part is cleared again.                                            ***
+*****************************************************************************/
+static void window_show(struct window *w, unsigned long n, double t,
+			unsigned int k)
+{
+	static const double q[] = {0.5, 0.9, 0.99};
+	unsigned int p[3];
+	unsigned long sum = 0;
+	unsigned int code, j = 0;
+
+	if (!w->st.count)
+		return;
+	for (code = w->st.min; (code <= w->st.max) && (j < 3); code++) {
+		sum += w->hist[code];
+		while ((j < 3) && (sum >= q[j] * w->st.count))
+			p[j++] = code;
+	}
+
+	fprintf(info, "Window %lu %.3fs", n, t);
+	if (nchannels > 1)
+		fprintf(info, " channel %u", channels[k]);
+	fprintf(info, ": n %lu, min %llu, max %llu, mean %.2f, stddev %.2f, "
+		"p50 %u, p90 %u, p99 %u\n", w->st.count,
+		(unsigned long long)w->st.min, (unsigned long long)w->st.max,
+		w->st.mean, sqrt(w->st.m2 / w->st.count), p[0], p[1], p[2]);
+
+	memset(&w->hist[w->st.min], 0,
+	       (w->st.max - w->st.min + 1) * sizeof(w->hist[0]));
+	memset(&w->st, 0, sizeof(w->st));
+}
+
+
+/*****************************************************************************
+*** Function:    void print_outputs(int32_t (*outs)[DSP_BLOCK],            ***
+***                                 unsigned int n, const char *label,     ***
+***                                 unsigned long *count)                  ***
+***                                                                        ***
+*** Parameters:  outs:  filtered or calibrated values of each channel      ***
+***              n:     number of values per channel                       ***
+***              label: start of each line                                 ***
+***              count: number of the last line shown, updated             ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show one line per scan of the processed values, as calibrated units    ***
+*** with -C or otherwise as LSB with the fraction of the filters.          ***
+*****************************************************************************/
+static void print_outputs(int32_t (*outs)[DSP_BLOCK], unsigned int n,
+			  const char *label, unsigned long *count)
+{
+	unsigned int j, k;
+
+	for (j = 0; j < n; j++) {
+		printf("%s %lu:", label, ++*count);
+		for (k = 0; k < nchannels; k++) {
+			if (nchannels > 1)
+				printf(" %u=", channels[k]);
+			else
+				printf(" ");
+			if (cal_on)
+				printf("%.3f %s",
+				       outs[k][j] / (double)CAL_SCALE,
+				       cal[channels[k]].unit);
+			else
+				printf("%.2f", outs[k][j]
+				       / (double)(1 << DSP_FRAC_BITS));
+		}
+		printf("\n");
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    int read_samples(int fd, unsigned int samples,            ***
+***                               unsigned int delay)                      ***
+***                                                                        ***
+*** Parameters:  fd:      file descriptor of the ADC device                ***
+***              samples: number of samples to read                        ***
+***              delay:   delay between samples in seconds                 ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Convert and print the samples. The samples are paced in one of three   ***
+*** ways:                                                                  ***
+*** - with -r, on a fixed grid of absolute deadlines. The lateness of each ***
+***   wakeup against the grid is collected; if a sample takes longer than  ***
+***   a period, the missed deadlines are counted and skipped, so the       ***
+***   following samples stay on the grid.                                  ***
+*** - with -s, back to back from the ADC in continuous conversion mode.    ***
+***   The client is registered once, then each sample only needs one       ***
+***   ADC_CONVERT call. With data overwrite enabled, the result register   ***
+***   always holds the newest conversion.                                  ***
+*** - otherwise with a delay of whole seconds.                             ***
+*** The samples are collected in blocks for the software filters and the   ***
+*** raw outputs. With -W, only a summary of each window is shown. With 0   ***
+*** samples, the run only ends with SIGINT or SIGTERM. At the end, the     ***
+*** achieved sample rate and the spread of the intervals between samples   ***
+*** are shown.                                                             ***
+*****************************************************************************/
+static int read_samples(int fd, unsigned int samples, unsigned int delay)
+{
+	struct interval_stats st = {0}, late = {0};
+	struct interval_stats settle[MAX_CHANNELS];
+	unsigned int values[MAX_CHANNELS];
+	static uint16_t blk[MAX_CHANNELS][DSP_BLOCK];
+	static int32_t outs[MAX_CHANNELS][DSP_BLOCK];
+	unsigned int nblk = 0, block, nout;
+	unsigned long outputs = 0;
+	int filtered = ntaps || avg_len || dec;
+	uint64_t start, last, now = 0, next, scan, t, period = 0, blk_time = 0;
+	uint64_t win_start;
+	unsigned long missed = 0, nwin = 0, win_count = 0;
+	unsigned long long i;
+	unsigned int k;
+	int done = 0;
+	const char *what;
+
+	memset(settle, 0, sizeof(settle));
+	if (stream && (nchannels == 1)
+	    && (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1)) {
+		perror("Can not register client");
+		return 1;
+	}
+	if (rate > 0)
+		period = 1e9 / rate;
+
+	/* Slow sampling handles every sample, fast sampling whole blocks */
+	block = (stream || (rate >= 1000)) ? DSP_BLOCK : 1;
+
+	if (!samples)
+		catch_signals();
+
+	start = last = next = win_start = now_ns();
+	for (i = 1; !done; i++) {
+		if (period) {
+			next += period;
+			sleep_until(next);
+			interval_add(&late, now_ns() - next);
+		} else if (!stream) {
+			sleep(delay);
+		}
+
+		scan = now_ns();
+		for (k = 0; k < nchannels; k++) {
+			t = now_ns();
+			if (convert_channel(fd, channels[k]))
+				return 1;
+			now = now_ns();
+			interval_add(&settle[k], now - t);
+			values[k] = testfeature.result0;
+		}
+		if (i > 1)
+			interval_add(&st, scan - last);
+		last = scan;
+		done = (i == samples) || stopped;
+
+		if (window_n || window_ms) {
+			for (k = 0; k < nchannels; k++)
+				window_add(&win[k], values[k]);
+			win_count++;
+			if (done || (window_n && (win_count >= window_n))
+			    || (window_ms
+				&& (scan - win_start >= window_ms * 1000000))) {
+				nwin++;
+				for (k = 0; k < nchannels; k++)
+					window_show(&win[k], nwin,
+						    (scan - start) / 1e9, k);
+				fflush(stdout);
+				win_count = 0;
+				win_start = scan;
+			}
+		}
+
+		if (!nblk)
+			blk_time = scan;
+		for (k = 0; k < nchannels; k++)
+			blk[k][nblk] = values[k];
+		if ((++nblk == block) || done) {
+			if ((raw_out || ring) && write_raw(blk, nblk, blk_time))
+				return 1;
+			nout = 0;
+			if (filtered) {
+				for (k = 0; k < nchannels; k++) {
+					nout = dsp_run(&dsp[k], blk[k], nblk,
+						       outs[k]);
+					if (cal_on)
+						cal_filtered(channels[k],
+							     outs[k], nout);
+				}
+			} else if (cal_on) {
+				for (k = 0; k < nchannels; k++)
+					cal_block(channels[k], blk[k], nblk,
+						  outs[k]);
+				nout = nblk;
+			}
+			nblk = 0;
+			if (!quiet)
+				print_outputs(outs, nout,
+					      filtered ? "Output" : "Sample",
+					      &outputs);
+		}
+
+		if (quiet || filtered || cal_on) {
+			/* Only the statistics */
+		} else if (nchannels == 1) {
+			printf("Sample %llu: %d\n", i, values[0]);
+		} else {
+			printf("Scan %llu %.6f:", i, (scan - start) / 1e9);
+			for (k = 0; k < nchannels; k++)
+				printf(" %u=%u", channels[k], values[k]);
+			printf("\n");
+		}
+
+		/* Skip the deadlines that have already passed */
+		if (period && (now >= next + period)) {
+			missed += (now - next) / period;
+			next += (now - next) / period * period;
+		}
+	}
+
+	if (st.count) {
+		what = (nchannels > 1) ? "scans" : "samples";
+		fprintf(info, "%llu %s in %.3fs, %.1f %s/s", i - 1, what,
+			(last - start) / 1e9, 1e9 / st.mean, what);
+		if (nchannels > 1)
+			fprintf(info, ", %.1f conversions/s",
+				1e9 / st.mean * nchannels);
+		fprintf(info, "\n");
+		fprintf(info, "Interval: min %.1fus, mean %.1fus, max %.1fus, "
+			"stddev %.1fus\n", st.min / 1e3, st.mean / 1e3,
+			st.max / 1e3, sqrt(st.m2 / st.count) / 1e3);
+	}
+	if (late.count)
+		fprintf(info, "Wakeup lateness: min %.1fus, mean %.1fus, "
+			"max %.1fus, stddev %.1fus, %lu missed deadlines\n",
+			late.min / 1e3, late.mean / 1e3, late.max / 1e3,
+			sqrt(late.m2 / late.count) / 1e3, missed);
+	if (nchannels > 1) {
+		for (k = 0; k < nchannels; k++)
+			fprintf(info, "Channel %2u settle: min %.1fus, "
+				"mean %.1fus, max %.1fus\n", channels[k],
+				settle[k].min / 1e3, settle[k].mean / 1e3,
+				settle[k].max / 1e3);
+	}
+	if (ring)
+		fprintf(info, "Ring: %u blocks dropped\n", ring->drops);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_watch(char *spec)                               ***
+***                                                                        ***
+*** Parameters:  spec: lt:value, ge:value, out:low-high or in:low-high     ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Translate the alarm condition into the compare function settings. The  ***
+*** range conditions use CV1 <= CV2, then ACFGT selects outside            ***
+*** (exclusive) or inside (inclusive) of the range.                        ***
+*****************************************************************************/
+static int parse_watch(char *spec)
+{
+	char *end;
+
+	if (!strncmp(spec, "lt:", 3) || !strncmp(spec, "ge:", 3)) {
+		watch_cond.greater = (spec[0] == 'g');
+		watch_cond.range = 0;
+		watch_cond.cv1 = strtoul(spec + 3, &end, 0);
+		watch_cond.cv2 = 0;
+	} else if (!strncmp(spec, "out:", 4) || !strncmp(spec, "in:", 3)) {
+		watch_cond.greater = (spec[0] == 'i');
+		watch_cond.range = 1;
+		spec = strchr(spec, ':') + 1;
+		watch_cond.cv1 = strtoul(spec, &end, 0);
+		if ((end == spec) || (*end != '-'))
+			return 1;
+		spec = end + 1;
+		watch_cond.cv2 = strtoul(spec, &end, 0);
+		if (watch_cond.cv2 < watch_cond.cv1)
+			return 1;
+	} else {
+		return 1;
+	}
+	if ((end == spec) || *end || (watch_cond.cv1 > ADC_MAX_VALUE)
+	    || (watch_cond.cv2 > ADC_MAX_VALUE))
+		return 1;
+
+	watch_on = 1;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    const char *watch_name(const struct watch *w)             ***
+***                                                                        ***
+*** Parameters:  w: compare condition                                      ***
+***                                                                        ***
+*** Return:      Readable form of the condition                            ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Describe the compare condition, the result is in a static buffer.      ***
+*****************************************************************************/
+static const char *watch_name(const struct watch *w)
+{
+	static char name[32];
+
+	if (!w->range)
+		sprintf(name, "%s %u", w->greater ? ">=" : "<", w->cv1);
+	else
+		sprintf(name, "%s %u..%u", w->greater ? "inside" : "outside",
+			w->cv1, w->cv2);
+
+	return name;
+}
+
+
+/*****************************************************************************
+*** Function:    int watch_match(const struct watch *w, unsigned int v)    ***
+***                                                                        ***
+*** Parameters:  w: compare condition                                      ***
+***              v: conversion result                                      ***
+***                                                                        ***
+*** Return:      1: v meets the condition; 0: it does not                  ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** The same test as the compare function of the ADC, for a check of the   ***
+*** results that the driver returns.                                       ***
+*****************************************************************************/
+static int watch_match(const struct watch *w, unsigned int v)
+{
+	if (!w->range)
+		return w->greater ? (v >= w->cv1) : (v < w->cv1);
+	if (w->greater)
+		return (v >= w->cv1) && (v <= w->cv2);
+
+	return (v < w->cv1) || (v > w->cv2);
+}
+
+
+/*****************************************************************************
+*** Function:    int adc_number(int fd, unsigned int *adc)                 ***
+***                                                                        ***
+*** Parameters:  fd:  file descriptor of the ADC device                    ***
+***              adc: returns the number of the ADC (0 or 1)               ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** The driver creates one device node per ADC with the number of the ADC  ***
+*** as minor number. Take it from the open node and not from its name,     ***
+*** which may be a link or a node made by hand.                            ***
+*****************************************************************************/
+static int adc_number(int fd, unsigned int *adc)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1) {
+		perror("Can not stat device");
+		return 1;
+	}
+	if (!S_ISCHR(st.st_mode) || (minor(st.st_rdev) > 1)) {
+		fprintf(stderr, "Can not tell which ADC the device is\n");
+		return 1;
+	}
+	*adc = minor(st.st_rdev);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    volatile uint32_t *map_compare(unsigned int adc)          ***
+***                                                                        ***
+*** Parameters:  adc: number of the ADC (0 or 1)                           ***
+***                                                                        ***
+*** Return:      Registers of the ADC; NULL: Failure                       ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Map the registers of the ADC through /dev/mem. struct adc_feature has  ***
+*** no field for the compare values, so this is the only way to set them.  ***
+*****************************************************************************/
+static volatile uint32_t *map_compare(unsigned int adc)
+{
+	volatile uint32_t *regs;
+	int mem;
+
+	mem = open("/dev/mem", O_RDWR | O_SYNC);
+	if (mem < 0) {
+		perror("Can not open /dev/mem");
+		return NULL;
+	}
+	regs = mmap(NULL, ADC_REGS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    mem, adc ? ADC1_BASE : ADC0_BASE);
+	close(mem);
+	if (regs == MAP_FAILED) {
+		perror("Can not map ADC registers");
+		return NULL;
+	}
+
+	return regs;
+}
+
+
+/*****************************************************************************
+*** Function:    int set_compare(int fd, volatile uint32_t *regs,          ***
+***                              const struct watch *w)                    ***
+***                                                                        ***
+*** Parameters:  fd:   file descriptor of the ADC device                   ***
+***              regs: registers of the ADC from map_compare()             ***
+***              w:    compare condition                                   ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Program the compare function. The driver sets ACFE, ACFGT and ACREN    ***
+*** with ADC_CONFIGURATION, then CV1 and CV2 are written directly to the   ***
+*** ADC_CV register. Then the client is registered again to restart the    ***
+*** continuous conversion with the new condition.                          ***
+*****************************************************************************/
+static int set_compare(int fd, volatile uint32_t *regs, const struct watch *w)
+{
+	testfeature.compare_func_ena = ADCIOC_ACFEON_SET;
+	testfeature.greater_ena =
+		w->greater ? ADCIOC_ACFGTON_SET : ADCIOC_ACFGTOFF_SET;
+	testfeature.range_ena =
+		w->range ? ADCIOC_ACRENON_SET : ADCIOC_ACRENOFF_SET;
+	if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
+		perror("Can not configure ADC");
+		return 1;
+	}
+
+	regs[ADC_CV / 4] = w->cv1 | (w->cv2 << 16);
+
+	if (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1) {
+		perror("Can not register client");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void run_hook(unsigned int value, int alarm)              ***
+***                                                                        ***
+*** Parameters:  value: conversion result that crossed the limit           ***
+***              alarm: 1: the value entered the alarm condition; 0: left  ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Run the hook command (-x) with the event in the environment variables  ***
+*** ADC_STATE (alarm or normal), ADC_VALUE and ADC_CHANNEL.                ***
+*****************************************************************************/
+static void run_hook(unsigned int value, int alarm)
+{
+	char buf[16];
+
+	setenv("ADC_STATE", alarm ? "alarm" : "normal", 1);
+	sprintf(buf, "%u", value);
+	setenv("ADC_VALUE", buf, 1);
+	sprintf(buf, "%u", channels[0]);
+	setenv("ADC_CHANNEL", buf, 1);
+	if (system(hook) == -1)
+		perror("Can not run hook");
+}
+
+
+/*****************************************************************************
+*** Function:    int watch_adc(int fd, unsigned int adc, unsigned int      ***
+***                            alarms, double poll_rate)                   ***
+***                                                                        ***
+*** Parameters:  fd:        file descriptor of the ADC device              ***
+***              adc:       number of the ADC (0 or 1)                     ***
+***              alarms:    stop after this many alarms, 0: only by signal ***
+***              poll_rate: rate for polling, and to compare the wakeups   ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Let the ADC watch the channel. In continuous conversion with the       ***
+*** compare function enabled, the ADC only completes a conversion when the ***
+*** result meets the condition, so ADC_CONVERT sleeps in the driver until  ***
+*** then and the CPU is idle in between. After each crossing, the          ***
+*** condition is inverted (ACFGT toggled, which gives exactly the opposite ***
+*** condition), so the next wakeup is the return to normal and a value     ***
+*** that stays beyond the limit does not wake up the program again. Each   ***
+*** crossing is shown and passed to the hook. At the end, the wakeups per  ***
+*** hour are compared with polling at the same responsiveness.             ***
+*** Without access to the registers (no /dev/mem), the channel is polled   ***
+*** at poll_rate instead and the same condition is checked in software.    ***
+*** The same fallback is taken if a conversion returns a value that does   ***
+*** not meet the armed condition, as then the compare function is ignored. ***
+*****************************************************************************/
+static int watch_adc(int fd, unsigned int adc, unsigned int alarms,
+		     double poll_rate)
+{
+	struct watch cur = watch_cond;
+	volatile uint32_t *regs;
+	unsigned long wakeups = 0, count = 0;
+	unsigned int v;
+	uint64_t start, next, t;
+	int alarm = 0;
+
+	catch_signals();
+
+	regs = map_compare(adc);
+	if (!regs) {
+		fprintf(stderr, "No compare function, polling at %.1f Hz\n",
+			poll_rate);
+		if (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1) {
+			perror("Can not register client");
+			return 1;
+		}
+	} else if (set_compare(fd, regs, &cur)) {
+		return 1;
+	}
+	fprintf(info, "Watching channel %u for %s\n", channels[0],
+		watch_name(&watch_cond));
+
+	start = now_ns();
+	next = start;
+	while (!stopped && (!alarms || (count < alarms))) {
+		if (!regs) {
+			next += 1e9 / poll_rate;
+			sleep_until(next);
+		}
+		if (ioctl(fd, ADC_CONVERT, &testfeature) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("Can not convert");
+			return 1;
+		}
+		wakeups++;
+
+		/* Only count results that really meet the condition. If the
+		   armed compare function returns one that does not, the
+		   driver or ADC ignores ACFE and each conversion would return
+		   at once, so fall back to polling at poll_rate. */
+		v = testfeature.result0;
+		if (!watch_match(&cur, v)) {
+			if (regs) {
+				fprintf(stderr, "Compare function ignored, "
+					"polling at %.1f Hz\n", poll_rate);
+				testfeature.compare_func_ena =
+					ADCIOC_ACFEOFF_SET;
+				if ((ioctl(fd, ADC_CONFIGURATION,
+					   &testfeature) == -1)
+				    || (ioctl(fd, ADC_REG_CLIENT,
+					      &testfeature) == -1)) {
+					perror("Can not configure ADC");
+					return 1;
+				}
+				regs = NULL;
+				next = now_ns();
+			}
+			continue;
+		}
+		alarm = !alarm;
+		if (alarm)
+			count++;
+		printf("%s %.3f: %u\n", alarm ? "Alarm" : "Normal",
+		       (now_ns() - start) / 1e9, v);
+		fflush(stdout);
+		if (hook)
+			run_hook(v, alarm);
+
+		cur.greater = !cur.greater;
+		if (regs && set_compare(fd, regs, &cur))
+			return 1;
+	}
+
+	t = now_ns() - start;
+	fprintf(info, "%lu alarm(s), %lu wakeup(s) in %.1fs, %.1f wakeups/h\n",
+		count, wakeups, t / 1e9, wakeups * 3600e9 / t);
+	fprintf(info, "Polling at %.1f Hz: %.0f wakeups/h\n", poll_rate,
+		poll_rate * 3600);
+
+	testfeature.compare_func_ena = ADCIOC_ACFEOFF_SET;
+	if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
+		perror("Can not configure ADC");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void bench_kernels(void)                                  ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Time the FIR and integrate kernels on synthetic data, the plain C      ***
+*** versions and, on ARM, the NEON versions. Without -f, a 16 tap boxcar   ***
+*** FIR is used.                                                           ***
+*****************************************************************************/
+static void bench_kernels(void)
+{
+	static int16_t in[MAX_TAPS - 1 + DSP_BLOCK];
+	static int32_t out[DSP_BLOCK];
+	int16_t saved[MAX_TAPS];
+	unsigned int saved_n = ntaps, i, r;
+	volatile int64_t sink = 0;
+	uint64_t t;
+
+	memcpy(saved, taps, sizeof(taps));
+	if (!ntaps) {
+		ntaps = 16;
+		for (i = 0; i < ntaps; i++)
+			taps[i] = 32768 / 16;
+	}
+	srand(1);
+	for (i = 0; i < MAX_TAPS - 1 + DSP_BLOCK; i++)
+		in[i] = 2048 + rand() % 64;
+
+	printf("Kernels (%u taps, ns/sample):", ntaps);
+	t = now_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		fir_c(in, out, DSP_BLOCK);
+	printf(" fir_c %.2f",
+	       (now_ns() - t) / (double)BENCH_ROUNDS / DSP_BLOCK);
+	t = now_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		sink += sum_c(out, DSP_BLOCK);
+	printf(", sum_c %.2f",
+	       (now_ns() - t) / (double)BENCH_ROUNDS / DSP_BLOCK);
+#ifdef __ARM_NEON
+	t = now_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		fir_neon(in, out, DSP_BLOCK);
+	printf(", fir_neon %.2f",
+	       (now_ns() - t) / (double)BENCH_ROUNDS / DSP_BLOCK);
+	t = now_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		sink += sum_neon(out, DSP_BLOCK);
+	printf(", sum_neon %.2f",
+	       (now_ns() - t) / (double)BENCH_ROUNDS / DSP_BLOCK);
+#endif
+	printf("\n");
+
+	memcpy(taps, saved, sizeof(taps));
+	ntaps = saved_n;
+}
+
+
+/*****************************************************************************
+*** Function:    int bench_averaging(int fd, unsigned int count)           ***
+***                                                                        ***
+*** Parameters:  fd:    file descriptor of the ADC device                  ***
+***              count: number of averaged values per setting              ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Compare the hardware averaging of the ADC (ha_sel/ha_sam) with the     ***
+*** same averaging in software (integrate and dump of raw samples) on the  ***
+*** first channel. For each setting, the averaged values per second and    ***
+*** the noise (standard deviation in LSB) are shown; with a steady input,  ***
+*** the noise shows the gain of each averaging method. When streaming a    ***
+*** single channel, convert_channel() does not register the client, so it  ***
+*** is registered after each reconfiguration to restart the conversion.    ***
+*****************************************************************************/
+static int bench_averaging(int fd, unsigned int count)
+{
+	static const unsigned int navg[] = {1, 4, 8, 16, 32};
+	struct interval_stats st;
+	int32_t buf[32];
+	unsigned int a, pass, hw, j, n, raw;
+	uint64_t t;
+
+	printf("Averaging  values/s    mean LSB  noise LSB\n");
+	for (a = 0; a < sizeof(navg) / sizeof(navg[0]); a++) {
+		n = navg[a];
+		for (pass = 0; pass < ((n > 1) ? 2 : 1); pass++) {
+			hw = !pass;
+			testfeature.ha_sel = (hw && (n > 1)) ?
+				ADCIOC_HA_SET : ADCIOC_HA_DIS;
+			testfeature.ha_sam = n;
+			if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
+				perror("Can not configure ADC");
+				return 1;
+			}
+			if (stream && (nchannels == 1)
+			    && (ioctl(fd, ADC_REG_CLIENT,
+				      &testfeature) == -1)) {
+				perror("Can not register client");
+				return 1;
+			}
+
+			memset(&st, 0, sizeof(st));
+			raw = hw ? count : count * n;
+			t = now_ns();
+			for (j = 0; j < raw; j++) {
+				if (convert_channel(fd, channels[0]))
+					return 1;
+				if (hw) {
+					interval_add(&st, testfeature.result0
+						     << DSP_FRAC_BITS);
+					continue;
+				}
+				buf[j % n] = testfeature.result0
+					<< DSP_FRAC_BITS;
+				if (j % n == n - 1)
+					interval_add(&st, (dsp_sum(buf, n)
+							   + n / 2) / n);
+			}
+			t = now_ns() - t;
+
+			printf("%s x%-3u %10.1f %11.2f %10.3f\n",
+			       hw ? "hw" : "sw", n, count * 1e9 / t,
+			       st.mean / (1 << DSP_FRAC_BITS),
+			       sqrt(st.m2 / st.count) / (1 << DSP_FRAC_BITS));
+		}
+	}
+
+	testfeature.ha_sel = ADCIOC_HA_DIS;
+	if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
+		perror("Can not configure ADC");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int cmp_sweep(const void *a, const void *b)               ***
+***                                                                        ***
+*** Parameters:  a, b: results to compare                                  ***
+***                                                                        ***
+*** Return:      <0, 0, >0 for qsort()                                     ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Order the sweep results by conversions/s, the fastest first.           ***
+*****************************************************************************/
+static int cmp_sweep(const void *a, const void *b)
+{
+	const struct sweep_result *ra = a, *rb = b;
+
+	return (ra->rate < rb->rate) - (ra->rate > rb->rate);
+}
+
+
+/*****************************************************************************
+*** Function:    int sweep_configs(int fd, unsigned int count,             ***
+***                                double max_noise)                       ***
+***                                                                        ***
+*** Parameters:  fd:        file descriptor of the ADC device              ***
+***              count:     conversions per configuration                  ***
+***              max_noise: only show configurations with at most this     ***
+***                         noise (in 12 bit LSB), 0: show all             ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Walk all combinations of resolution, clock source, clock divider,      ***
+*** sample time, high speed and low power mode. For each one, the first    ***
+*** channel is converted <count> times after a few discarded conversions.  ***
+*** The time of each conversion gives the latency, the total time the      ***
+*** conversions/s. With a steady input on the channel, the standard        ***
+*** deviation of the results is the noise; it is also scaled to 12 bit     ***
+*** LSB, so the resolutions can be compared. The table is sorted by        ***
+*** conversions/s, so the first row within the noise limit is the fastest  ***
+*** configuration that is accurate enough. Configurations that the driver  ***
+*** rejects are left out.                                                  ***
+*****************************************************************************/
+static int sweep_configs(int fd, unsigned int count, double max_noise)
+{
+	static struct sweep_result res[SWEEP_CONFIGS];
+	struct adc_feature saved = testfeature;
+	struct interval_stats lat, val;
+	struct sweep_result *r;
+	unsigned int n = 0, rejected = 0, shown = 0, j;
+	unsigned int i, x, b, c, d, t, hs, lp;
+	uint64_t start, t0, t1;
+
+	fprintf(info, "Sweeping %u configurations, %u conversions each\n",
+		SWEEP_CONFIGS, count);
+	for (i = 0; i < SWEEP_CONFIGS; i++) {
+		/* Split the index into the settings, lp_con changes fastest */
+		x = i;
+		lp = x % 2;
+		x /= 2;
+		hs = x % 2;
+		x /= 2;
+		t = x % ARRAY_SIZE(sweep_sam);
+		x /= ARRAY_SIZE(sweep_sam);
+		d = x % ARRAY_SIZE(sweep_div);
+		x /= ARRAY_SIZE(sweep_div);
+		c = x % ARRAY_SIZE(sweep_clk);
+		b = x / ARRAY_SIZE(sweep_clk);
+
+		testfeature.res_mode = sweep_bits[b].value;
+		testfeature.clk_sel = sweep_clk[c].value;
+		testfeature.clk_div_num = sweep_div[d].value;
+		testfeature.sam_time = sweep_sam[t].value;
+		testfeature.hs_oper = hs ? ADCIOC_HSON_SET : ADCIOC_HSOFF_SET;
+		testfeature.lp_con = lp ? ADCIOC_LPON_SET : ADCIOC_LPOFF_SET;
+		testfeature.channel = (enum adc_channel)channels[0];
+		if ((ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1)
+		    || (stream && (nchannels == 1)
+			&& (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1))) {
+			rejected++;
+			continue;
+		}
+
+		/* Let the ADC settle with the new configuration */
+		for (j = 0; j < SWEEP_WARMUP; j++) {
+			if (convert_channel(fd, channels[0]))
+				return 1;
+		}
+
+		memset(&lat, 0, sizeof(lat));
+		memset(&val, 0, sizeof(val));
+		start = t0 = now_ns();
+		for (j = 0; j < count; j++) {
+			if (convert_channel(fd, channels[0]))
+				return 1;
+			t1 = now_ns();
+			interval_add(&lat, t1 - t0);
+			interval_add(&val, testfeature.result0);
+			t0 = t1;
+		}
+
+		r = &res[n++];
+		r->bits = b;
+		r->clk = c;
+		r->div = d;
+		r->sam = t;
+		r->hs = hs;
+		r->lp = lp;
+		r->rate = count * 1e9 / (t0 - start);
+		r->lat_mean = lat.mean / 1e3;
+		r->lat_max = lat.max / 1e3;
+		r->noise = sqrt(val.m2 / val.count);
+		r->noise12 = r->noise * (1 << (12 - sweep_bits[b].bits));
+	}
+
+	testfeature = saved;
+	if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
+		perror("Can not configure ADC");
+		return 1;
+	}
+
+	qsort(res, n, sizeof(res[0]), cmp_sweep);
+	printf("  conv/s   lat us   max us  noise LSB  12 bit LSB  "
+	       "bits clock div sample hs lp\n");
+	for (j = 0; j < n; j++) {
+		r = &res[j];
+		if ((max_noise > 0) && (r->noise12 > max_noise))
+			continue;
+		shown++;
+		printf("%8.1f %8.2f %8.2f %10.3f %11.3f  %4u %-5s %3s %6s "
+		       "%-3s %s\n", r->rate, r->lat_mean, r->lat_max, r->noise,
+		       r->noise12, sweep_bits[r->bits].bits,
+		       sweep_clk[r->clk].name, sweep_div[r->div].name,
+		       sweep_sam[r->sam].name, r->hs ? "on" : "off",
+		       r->lp ? "on" : "off");
+	}
+	fprintf(info, "%u configuration(s) shown, %u rejected by the driver\n",
+		shown, rejected);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int sim_start(void)                                       ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      0: Success                                                ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Start the simulated backend. Its clock runs at the trigger rate of -r. ***
+*****************************************************************************/
+static int sim_start(void)
+{
+	sim.period = 1e9 / ((rate > 0) ? rate : SIM_RATE);
+	if (!sim.period)	/* sim_read() divides by it */
+		sim.period = 1;
+	sim.next = now_ns();
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int sim_read(uint16_t *buf, unsigned int scans)           ***
+***                                                                        ***
+*** Parameters:  buf:   buffer of the caller for scans * nchannels values  ***
+***              scans: number of samples per channel                      ***
+***                                                                        ***
+*** Return:      0: Success                                                ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Get the next simulated block of samples, one value per channel of the  ***
+*** scan list for each scan. Wait until the last sample of the block would ***
+*** have been converted and then fill the buffer with a ramp and some      ***
+*** noise. If the caller is more than a block late, the blocks that a DMA  ***
+*** ring would have overwritten are counted as overruns and skipped.       ***
+*****************************************************************************/
+static int sim_read(uint16_t *buf, unsigned int scans)
+{
+	uint64_t end, now, block_ns, late;
+	unsigned int i, k;
+
+	block_ns = scans * sim.period;
+	end = sim.next + block_ns;
+	now = now_ns();
+	if (now >= end + block_ns) {
+		late = (now - end) / block_ns;
+		sim.overruns += late;
+		sim.index += late * scans;
+		end += late * block_ns;
+	}
+	sleep_until(end);
+
+	for (i = 0; i < scans; i++) {
+		for (k = 0; k < nchannels; k++) {
+			sim.seed = sim.seed * 1103515245 + 12345;
+			buf[i * nchannels + k] = (SIM_BASE
+				+ ((sim.index + i) * (k + 1)) % SIM_SPAN
+				+ ((sim.seed >> 16) & SIM_NOISE))
+				& ADC_MAX_VALUE;
+		}
+	}
+	sim.index += scans;
+	sim.next = end;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    unsigned long sim_overruns(void)                          ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      Blocks skipped by sim_read() so far                       ***
+*****************************************************************************/
+static unsigned long sim_overruns(void)
+{
+	return sim.overruns;
+}
+
+
+/* The simulation, the only backend while the driver has no DMA read */
+static const struct block_backend sim_backend = {
+	.name = "simulated",
+	.start = sim_start,
+	.read = sim_read,
+	.stop = NULL,
+	.overruns = sim_overruns,
 };
 
 
+/*****************************************************************************
+*** Function:    int block_acquire(const struct block_backend *be,         ***
+***                                unsigned int scans,                     ***
+***                                unsigned int blocks)                    ***
+***                                                                        ***
+*** Parameters:  be:     source of the blocks                              ***
+***              scans:  samples per channel and block                     ***
+***              blocks: number of blocks, 0: until Ctrl-C                 ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Acquire blocks from the backend into one buffer and show the mean of   ***
+*** each channel per block. At the end, the throughput of the delivered    ***
+*** samples, the samples lost by overruns, the time spent waiting for each ***
+*** block and the CPU load (CPU time of the process against the elapsed    ***
+*** time) are shown. The backend is stopped on every path after its start. ***
+*** With the simulated backend, the CPU load includes the generator that   ***
+*** fills the blocks, it is no measurement of a DMA transfer.              ***
+*****************************************************************************/
+static int block_acquire(const struct block_backend *be, unsigned int scans,
+			 unsigned int blocks)
+{
+	struct interval_stats wait = {0};
+	struct timespec ts;
+	uint16_t *buf;
+	uint64_t start, t, elapsed, cpu;
+	unsigned long n, sum, lost;
+	unsigned int i, k;
+	int ret = 0;
+
+	buf = malloc(scans * nchannels * sizeof(buf[0]));
+	if (!buf) {
+		perror("Can not allocate block buffer");
+		return 1;
+	}
+	if (!blocks)
+		catch_signals();
+	if (be->start()) {
+		free(buf);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	cpu = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	start = now_ns();
+	for (n = 0; (!blocks || (n < blocks)) && !stopped; n++) {
+		t = now_ns();
+		if (be->read(buf, scans)) {
+			ret = 1;
+			break;
+		}
+		interval_add(&wait, now_ns() - t);
+		if (quiet)
+			continue;
+		printf("Block %lu %.3fs:", n + 1, (now_ns() - start) / 1e9);
+		for (k = 0; k < nchannels; k++) {
+			for (sum = 0, i = 0; i < scans; i++)
+				sum += buf[i * nchannels + k];
+			printf(" %u=%.1f", channels[k], (double)sum / scans);
+		}
+		printf("\n");
+	}
+	elapsed = now_ns() - start;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	cpu = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec - cpu;
+	if (be->stop)
+		be->stop();
+	free(buf);
+	if (ret)
+		return ret;
+
+	lost = be->overruns();
+	fprintf(info, "Backend %s: %lu blocks of %u scans in %.3fs, "
+		"%.1f blocks/s\n", be->name, n, scans, elapsed / 1e9,
+		n * 1e9 / elapsed);
+	fprintf(info, "Delivered: %.1f samples/s of %.1f samples/s "
+		"triggered\n", (double)n * scans * nchannels * 1e9 / elapsed,
+		(double)(n + lost) * scans * nchannels * 1e9 / elapsed);
+	fprintf(info, "Overruns: %lu blocks, %.2f%% of the samples lost\n",
+		lost, (n + lost) ? lost * 100.0 / (n + lost) : 0.0);
+	if (wait.count)
+		fprintf(info, "Block wait: min %.1fus, mean %.1fus, "
+			"max %.1fus\n", wait.min / 1e3, wait.mean / 1e3,
+			wait.max / 1e3);
+	fprintf(info, "CPU load (%s backend): %.2f%% (%.3fs CPU time)\n",
+		be->name, cpu * 100.0 / elapsed, cpu / 1e9);
+
+	return 0;
+}
+
+
 /*****************************************************************************
 *** Function:    void usage(const char *progname)                          ***
 ***                                                                        ***
@@ -70,14 +2270,82 @@ struct adc_feature testfeature = {
 void usage(const char *progname)
 {
 	printf("\n"
-	       "Usage: %s device [channel [samples [delay]]]\n"
+	       "Usage: %s [options] device [channel [samples [delay]]]\n"
 	       "\n"
 	       "  device:  ADC device to use (one of /dev/mvf_adc.?)\n"
-	       "  channel: ADC channel to use (default: %u)\n"
+	       "  channel: ADC channel or scan list to use, e.g. 0,3,8-11 "
+	       "(default: %u)\n"
 	       "  samples: number of samples to convert (default: %u)\n"
 	       "  delay:   delay between samples (in seconds, default: %u)\n"
+	       "\n"
+	       "options:\n"
+	       "  -s:      stream, convert continuously and read the samples "
+	       "back to back\n"
+	       "           (no delay), then show samples/s and the interval "
+	       "spread\n"
+	       "  -r rate: sample at <rate> Hz on a fixed grid of absolute "
+	       "deadlines, show\n"
+	       "           the wakeup lateness and missed deadlines\n"
+	       "  -p prio: run with SCHED_FIFO priority <prio> (1..99)\n"
+	       "  -m:      lock all memory with mlockall()\n"
+	       "  -f h0,h1,...: FIR filter with up to %d Q15 coefficients "
+	       "(32768 = 1.0)\n"
+	       "           and a sum of |h| of at most 16.0\n"
+	       "  -a len:  moving average over <len> samples (up to %d)\n"
+	       "  -d n[:order]: decimate by <n>, order 1: boxcar average "
+	       "(default),\n"
+	       "           2..%d: CIC filter\n"
+	       "  -B count: benchmark the filter kernels and compare "
+	       "hardware with software\n"
+	       "           averaging on the first channel, <count> values per "
+	       "setting\n"
+	       "  -o file: write the raw samples to <file> (- for stdout) as "
+	       "blocks of packed\n"
+	       "           uint16 scans, each behind a header with the time of "
+	       "its first scan\n"
+	       "  -R name[:kbytes]: also put the raw blocks into a shared "
+	       "memory ring\n"
+	       "           /dev/shm/<name> of <kbytes> (default: %d) for "
+	       "other processes\n"
+	       "  -w cond: watch the first channel with the compare function "
+	       "of the ADC and\n"
+	       "           only wake up when the value crosses the limit, "
+	       "<samples> is the\n"
+	       "           number of alarms (0: until Ctrl-C). <cond> is "
+	       "lt:value, ge:value,\n"
+	       "           out:low-high or in:low-high. Without access to "
+	       "/dev/mem, the channel\n"
+	       "           is polled at -r rate (or every <delay>) instead\n"
+	       "  -x cmd:  run <cmd> on each crossing, with ADC_STATE, "
+	       "ADC_VALUE, ADC_CHANNEL\n"
+	       "  -b bits: resolution 8, 10 or 12 (default)\n"
+	       "  -V ref:  voltage reference vref (default), valt or vbg\n"
+	       "  -C file: show calibrated values, <file> has lines\n"
+	       "           channel offset_mV gain vref_mV [unit mV:value "
+	       "mV:value ...]\n"
+	       "  -W n|Tms: only show min, max, mean, stddev and quantiles "
+	       "of the raw\n"
+	       "           samples per window of <n> samples or <T> ms\n"
+	       "  -S count[:noise]: benchmark all combinations of resolution, "
+	       "clock, divider,\n"
+	       "           sample time, high speed and low power on the first "
+	       "channel with\n"
+	       "           <count> conversions each; show the ones with at "
+	       "most <noise>\n"
+	       "           (in 12 bit LSB) ordered by conversions/s\n"
+	       "  -D scans: acquire blocks of <scans> samples per channel, "
+	       "<samples> is the\n"
+	       "           number of blocks; only with device 'sim' (the "
+	       "driver has no DMA\n"
+	       "           read yet), simulated at the trigger rate of -r "
+	       "(default: %d Hz)\n"
+	       "  -q:      quiet, do not print the samples\n"
+	       "\n"
+	       "With 0 samples, %s runs until it is stopped with Ctrl-C.\n"
 	       "\n",
-	       progname, DEFAULT_CHANNEL, DEFAULT_SAMPLES, DEFAULT_DELAY);
+	       progname, DEFAULT_CHANNEL, DEFAULT_SAMPLES, DEFAULT_DELAY,
+	       MAX_TAPS, MAX_AVG, MAX_ORDER, DEFAULT_RING_KB, SIM_RATE,
+	       progname);
 }
 
 
@@ -96,65 +2364,291 @@ void usage(const char *progname)
 *****************************************************************************/
 int main(int argc, char *argv[])
 {
-	int fd;
-	unsigned int i;
+	int fd = -1, ret = 1;
+	int opt, nargs;
+	char **args;
+	char *end;
 	char *device = device_path;
-	unsigned int channel = DEFAULT_CHANNEL;
+	char *channel = NULL;
+	char *raw_path = NULL;
+	char *ring_arg = NULL;
+	char *cal_path = NULL;
 	unsigned int samples = DEFAULT_SAMPLES;
 	unsigned int delay = DEFAULT_DELAY;
+	unsigned int adc = 0;
+	double poll_rate;
+	double max_noise = 0;
+
+	info = stdout;
+
+	/* Get command line options */
+	while ((opt = getopt(argc, argv,
+			     "sqr:p:mf:a:d:B:o:R:w:x:b:V:C:W:S:D:")) != -1) {
+		switch (opt) {
+		case 's':
+			stream = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'r':
+			rate = strtod(optarg, &end);
+			if ((end == optarg) || *end || !isfinite(rate)
+			    || (rate <= 0) || (rate > MAX_RATE)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'p':
+			rt_prio = strtol(optarg, &end, 0);
+			if ((end == optarg) || *end
+			    || (rt_prio < sched_get_priority_min(SCHED_FIFO))
+			    || (rt_prio > sched_get_priority_max(SCHED_FIFO))) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'm':
+			lock_mem = 1;
+			break;
+		case 'f':
+			if (parse_taps(optarg)) {
+				fprintf(stderr, "Invalid FIR coefficients\n");
+				return 1;
+			}
+			break;
+		case 'a':
+			avg_len = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end || (avg_len > MAX_AVG)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'd':
+			dec = strtoul(optarg, &end, 0);
+			if (*end == ':')
+				dec_order = strtoul(end + 1, &end, 0);
+			if (*end || (dec > MAX_DEC) || !dec_order
+			    || (dec_order > MAX_ORDER)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'B':
+			bench = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end || !bench) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'o':
+			raw_path = optarg;
+			break;
+		case 'R':
+			ring_arg = optarg;
+			break;
+		case 'w':
+			if (parse_watch(optarg)) {
+				fprintf(stderr, "Invalid watch condition\n");
+				return 1;
+			}
+			break;
+		case 'x':
+			hook = optarg;
+			break;
+		case 'b':
+			adc_bits = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end)
+				adc_bits = 0;
+			if (adc_bits == 8)
+				testfeature.res_mode = BIT8;
+			else if (adc_bits == 10)
+				testfeature.res_mode = BIT10;
+			else if (adc_bits == 12)
+				testfeature.res_mode = BIT12;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'V':
+			if (!strcmp(optarg, "vref"))
+				testfeature.vol_ref = ADCIOC_VR_VREF_SET;
+			else if (!strcmp(optarg, "valt"))
+				testfeature.vol_ref = ADCIOC_VR_VALT_SET;
+			else if (!strcmp(optarg, "vbg"))
+				testfeature.vol_ref = ADCIOC_VR_VBG_SET;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'C':
+			cal_path = optarg;
+			break;
+		case 'W':
+			window_n = strtoul(optarg, &end, 0);
+			if (!strcmp(end, "ms")) {
+				window_ms = window_n;
+				window_n = 0;
+			} else if (*end) {
+				window_n = 0;
+			}
+			if (!window_n && !window_ms) {
+				usage(argv[0]);
+				return 1;
+			}
+			quiet = 1;
+			break;
+		case 'S':
+			sweep = strtoul(optarg, &end, 0);
+			if (*end == ':')
+				max_noise = strtod(end + 1, &end);
+			if (*end || !sweep) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'D':
+			block_scans = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end || !block_scans
+			    || (block_scans > MAX_BLOCK_SCANS)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
 	/* Get command line arguments */
-	if ((argc < 2) || (argc > 5)) {
+	args = &argv[optind];
+	nargs = argc - optind;
+	if ((nargs < 1) || (nargs > 4)) {
 		usage(argv[0]);
 		return 1;
 	}
-	if ((argv[1][0] >= '0') && (argv[1][0] <= '9') && !argv[1][1])
-		device_path[strlen(device_path) - 1] = argv[1][0];
+	if ((args[0][0] >= '0') && (args[0][0] <= '9') && !args[0][1])
+		device_path[strlen(device_path) - 1] = args[0][0];
+	else
+		device = args[0];
+	simulated = !strcmp(device, "sim");
+	if (simulated && !block_scans) {
+		fprintf(stderr, "The simulated device only supports -D\n");
+		return 1;
+	}
+	if (block_scans && !simulated) {
+		fprintf(stderr, "-D needs DMA read support in the driver, "
+			"only device 'sim' is available\n");
+		return 1;
+	}
+	if (nargs > 1)
+		channel = args[1];
+	if (nargs > 2)
+		samples = strtoul(args[2], NULL, 0);
+	if (nargs > 3)
+		delay = strtoul(args[3], NULL, 0);
+	poll_rate = (rate > 0) ? rate : 1.0 / (delay ? delay : 1);
+	if (stream || (rate > 0) || watch_on || block_scans)
+		delay = 0;
+
+	if (!channel) {
+		nchannels = 1;
+		channels[0] = DEFAULT_CHANNEL;
+	} else if (parse_channels(channel)) {
+		fprintf(stderr, "Invalid channel list '%s'\n", channel);
+		return 1;
+	}
+	if ((raw_path || ring_arg)
+	    && (watch_on || sweep || bench || block_scans)) {
+		fprintf(stderr, "-o and -R only work when reading samples\n");
+		return 1;
+	}
+	if (watch_on && (nchannels > 1)) {
+		fprintf(stderr, "Watch mode needs a single channel\n");
+		return 1;
+	}
+	if (cal_path) {
+		if (load_cal(cal_path))
+			return 1;
+		build_cal();
+	}
+
+	/* The raw samples replace the printed samples */
+	if (raw_path) {
+		quiet = 1;
+		if (!strcmp(raw_path, "-")) {
+			raw_out = stdout;
+			info = stderr;
+		} else {
+			raw_out = fopen(raw_path, "wb");
+			if (!raw_out) {
+				perror("Can not open raw output");
+				return 1;
+			}
+		}
+	}
+	if (ring_arg) {
+		quiet = 1;
+		if (open_ring(ring_arg))
+			goto out;
+	}
+
+	fprintf(info, "Using device '%s', channel ", device);
+	if (channel)
+		fprintf(info, "%s", channel);
 	else
-		device = argv[1];
-	if (argc > 2)
-		channel = strtoul(argv[2], NULL, 0);
-	if (argc > 3)
-		samples = strtoul(argv[3], NULL, 0);
-	if (argc > 4)
-		delay = strtoul(argv[4], NULL, 0);
-
-	printf("Using device '%s', channel %u, %u sample(s), delay %us\n",
-	       device, channel, samples, delay);
+		fprintf(info, "%u", channels[0]);
+	fprintf(info, ", %u sample(s), delay %us%s\n", samples, delay,
+		stream ? ", continuous conversion" : "");
+	if (rate > 0)
+		fprintf(info, "Sampling at %.1f Hz\n", rate);
+	if (simulated) {
+		ret = block_acquire(&sim_backend, block_scans, samples);
+		goto out;
+	}
 	fd = open(device, O_RDWR);
 	if (fd < 0) {
 		perror("Can not open device");
-		return 1;
+		goto out;
 	}
+	if (watch_on && adc_number(fd, &adc))
+		goto out;
 
-	testfeature.channel = (enum adc_channel)channel;
+	testfeature.channel = (enum adc_channel)channels[0];
+	if (stream || watch_on) {
+		testfeature.cc_ena = ADCIOC_CCEON_SET;
+		testfeature.do_ena = ADCIOC_DOEON_SET;
+	}
 	if (ioctl(fd, ADC_INIT, &testfeature) == -1) {
 		perror("Can not init ADC");
-		return 1;
+		goto out;
 	}
 
 	if (ioctl(fd, ADC_CONFIGURATION, &testfeature) == -1) {
 		perror("Can not configure ADC");
-		return 1;
+		goto out;
 	}
 
-	for (i = 1; i <= samples; i++) {
-		sleep(delay);
-
-		if (ioctl(fd, ADC_REG_CLIENT, &testfeature) == -1) {
-			perror("Can not register client");
-			return 1;
-		}
-
-		if (ioctl(fd, ADC_CONVERT, &testfeature) == -1) {
-			perror("can not convert ADC value");
-			return 1;
-		}
-
-		printf("Sample %d: %d\n", i, testfeature.result0);
-	}
+	if (set_realtime())
+		goto out;
+	if (watch_on)
+		ret = watch_adc(fd, adc, samples, poll_rate);
+	else if (sweep)
+		ret = sweep_configs(fd, sweep, max_noise);
+	else if (bench) {
+		bench_kernels();
+		ret = bench_averaging(fd, bench);
+	} else
+		ret = read_samples(fd, samples, delay);
 
-	close(fd);
+out:
+	if (fd >= 0)
+		close(fd);
+	if (raw_out && (raw_out != stdout))
+		fclose(raw_out);
 
-	return 0;
+	return ret;
 }
@@ -24,7 +24,7 @@
 /*** "ip link set can0 up type can bitrate 125000"                         ***/
 /***                                                                       ***/
 /*** Compile with                                                          ***/
-/***            arm-linux-gcc -o can can.c                                 ***/
+/***            arm-linux-gcc -o can can.c -lpthread                       ***/
 /***                                                                       ***/
 /*****************************************************************************/
 /*** THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY ***/
@@ -33,131 +33,3512 @@
 /*** PURPOSE.                                                              ***/
 /*****************************************************************************/
 
+#define _GNU_SOURCE			/* recvmmsg(), sendmmsg() */
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include <net/if.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/can/bcm.h>
+#include <linux/can/isotp.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
 
 #define u_to_m	1000
 
-int soc;
+/* Maximum number of frames fetched with one recvmmsg() call */
+#define MAX_BATCH	64
+#define DEFAULT_BATCH	32
+
+/* Per-ID table: direct index for standard IDs, hash for extended IDs */
+#define STD_IDS		(CAN_SFF_MASK + 1)
+#define EXT_HASH_BITS	12
+#define EXT_HASH_SIZE	(1 << EXT_HASH_BITS)
+
+/* Default ID for sequence test traffic */
+#define DEFAULT_SEQ_ID	0x100
+
+/* A sequence number this far behind the expected one is a sender restart */
+#define SEQ_RESYNC	256
+
+/* Maximum number of receive filters given with -f */
+#define MAX_FILTERS	32
+
+#define IF_STATS_PATH	"/sys/class/net/%s/statistics/rx_packets"
+
+/* Maximum number of interfaces served by the read mode */
+#define MAX_IFS		16
+
+/* Log-linear histogram: 2^HIST_SUB_BITS linear buckets per power of two */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* Capture file: header, then a ring of fixed size records */
+#define CAP_MAGIC	0x50414346	/* "FCAP" */
+#define CAP_VERSION	1
+#define CAP_HDR_SIZE	512
+#define CAP_FD		0x80		/* record flag: CAN FD frame */
+#define DEFAULT_CAP_MB	16
+
+/* Largest capture file, so that the size in bytes fits into size_t and
+   off_t also on 32 bit targets */
+#define MAX_CAP_MB	(((sizeof(size_t) > 4) && (sizeof(off_t) > 4)) \
+			 ? 1024UL * 1024 : 2047UL)
+
+/* Maximum number of jobs of the cyclic mode */
+#define MAX_JOBS	MAX_FILTERS
+
+/* Ping pong mode: ping ID (pong is ID + 1), pings, echo timeout in ms */
+#define DEFAULT_PING_ID	0x7E0
+#define DEFAULT_PINGS	10000
+#define PING_TIMEOUT	100
+
+/* ISO-TP mode: sender tx:rx IDs, messages, message size in bytes; the
+   kernel's ISO-TP sockets take PDUs up to 8200 bytes (newer kernels make
+   this limit a module parameter with a slightly higher default) */
+#define DEFAULT_ISOTP_TX	0x7E0
+#define DEFAULT_ISOTP_RX	0x7E8
+#define DEFAULT_ISOTP_MSGS	100
+#define DEFAULT_ISOTP_SIZE	4095
+#define ISOTP_MAX_SIZE		8200
+
+/* Packet ring of -M: 64 blocks of 64 KB, a block is handed to user space
+   when it is full or 10 ms after its first frame */
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCKS		64
+#define RING_FRAME_SIZE		128
+#define RING_TIMEOUT_MS		10
+
+/* Room for the ancillary data of one received message */
+#define RX_CMSG_SIZE	(CMSG_SPACE(sizeof(struct timespec)) \
+			 + CMSG_SPACE(sizeof(struct scm_timestamping)) \
+			 + CMSG_SPACE(sizeof(uint32_t)))
+
+/* Receive buffer sizing: buffered time in ms and the memory the kernel
+   charges per frame (roughly the truesize of a CAN skb) */
+#define DEFAULT_RCVBUF_MS	100
+#define RCVBUF_FRAME_COST	1024
+
+int soc = -1;
+
+static unsigned int batch = DEFAULT_BATCH;
+static int quiet;
+static unsigned long rate;		/* frames/s in flood mode, 0: max */
+static unsigned long long count;	/* frames in flood mode, 0: endless */
+static int seq_mode;			/* send/check sequence test frames */
+static int stats_mode;			/* per-ID statistics table */
+static int fd_mode;			/* CAN FD frames with bit rate switch */
+static int hw_stamps;			/* request hardware timestamps */
+static int lat_mode;			/* collect latency histograms */
+static int rate_max;			/* "-r max": replay without timing */
+static unsigned long cap_mb = DEFAULT_CAP_MB;	/* capture file size */
+static int user_loop;			/* cyclic mode without CAN_BCM */
+static int rt_prio;			/* SCHED_FIFO priority, 0: off */
+static int rt_cpu = -1;			/* CPU to pin to, -1: any */
+static unsigned long rcvbuf_rate;	/* size SO_RCVBUF for frames/s */
+static unsigned long rcvbuf_ms = DEFAULT_RCVBUF_MS;
+static int isotp_bs;			/* ISO-TP block size, 0: no limit */
+static int isotp_stmin;			/* ISO-TP STmin byte */
+static int isotp_pad = -1;		/* ISO-TP padding byte, -1: off */
+static int ring_mode;			/* receive from TPACKET_V3 rings */
+static unsigned int fd_len = CANFD_MAX_DLEN;	/* FD payload length */
+static canid_t seq_id_first = DEFAULT_SEQ_ID;
+static canid_t seq_id_last = DEFAULT_SEQ_ID;
+static struct can_filter filters[MAX_FILTERS];
+static int nfilters;
+static can_err_mask_t err_mask;
+static volatile sig_atomic_t running = 1;
+
+/* Per-ID state; id_used marks a used slot of the extended ID hash */
+struct id_entry {
+	canid_t id;
+	int id_used;
+	uint32_t next_seq;		/* next expected sequence number */
+	uint64_t window;		/* bit n: seq next_seq-1-n was seen */
+	unsigned long long frames;
+	unsigned long long lost;
+	unsigned long long dup;
+	unsigned long long reorder;
+	unsigned long long corrupt;
+	unsigned long long resync;	/* sender restarts */
+	unsigned long long bytes;	/* stats mode */
+	unsigned long long last_frames;	/* frames at the last redraw */
+	uint64_t last_ts;
+	uint64_t period;		/* last period in ns */
+	uint64_t min_period;
+	uint64_t max_period;
+	unsigned int dlc[16];		/* frames per DLC code */
+};
+
+/* Per-ID table: direct index for standard IDs, hash for extended IDs */
+struct id_table {
+	struct id_entry std[STD_IDS];
+	struct id_entry ext[EXT_HASH_SIZE];
+	unsigned long long ext_overflow;
+};
+
+/* Header of a capture file, all values in host byte order */
+struct cap_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_size;		/* size of one record */
+	uint32_t nifs;			/* number of interface names */
+	uint64_t capacity;		/* number of records in the ring */
+	uint64_t head;			/* number of records written */
+	char ifnames[MAX_IFS][IFNAMSIZ];
+};
+
+/* One captured frame; data has 8 bytes (classic) or 64 bytes (FD) */
+struct cap_record {
+	uint64_t ts;			/* receive time in ns */
+	uint32_t can_id;
+	uint8_t ifslot;			/* index into ifnames[] */
+	uint8_t len;
+	uint8_t flags;			/* CANFD_* flags and CAP_FD */
+	uint8_t reserved;
+	uint8_t data[];
+};
+
+/* Log-linear histogram of nanosecond values */
+struct hist {
+	unsigned long long count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	unsigned long long buckets[HIST_BUCKETS];
+};
+
+/* Timing histograms of one interface */
+struct lat_stats {
+	uint64_t last_ts;		/* timestamp of the previous frame */
+	struct hist arrival;		/* inter-arrival time */
+	struct hist delivery;		/* kernel to user space */
+};
+
+/* Timestamps of a received frame in ns; hw is 0 if not available */
+struct rx_meta {
+	uint64_t sw;			/* kernel receive time, CLOCK_REALTIME */
+	uint64_t hw;			/* hardware time stamp of the driver */
+	uint64_t now;			/* CLOCK_REALTIME after recvmmsg() */
+	uint32_t drops;			/* SO_RXQ_OVFL counter of the socket */
+};
+
+/* Periodic frame of the cyclic mode */
+struct cyc_job {
+	struct canfd_frame frame;
+	uint64_t period;		/* in ns */
+	uint64_t next;			/* next send time of the user loop */
+	uint64_t last_ts;		/* time stamp of the previous copy */
+	unsigned long long frames;
+	struct hist jitter;		/* deviation from the period */
+};
+
+/* Statistics of one receive loop, shown once per second and at the end */
+struct rx_stats {
+	unsigned long long wakeups;
+	unsigned long long last_wakeups;
+	unsigned long long batch_hist[MAX_BATCH + 1];
+};
+
+/* TPACKET_V3 receive ring of one interface */
+struct can_ring {
+	uint8_t *map;
+	size_t size;
+	unsigned int block_size;
+	unsigned int nblocks;
+	unsigned int next;		/* next block to look at */
+};
+
+/* One interface of the receive loop */
+struct can_if {
+	char name[IFNAMSIZ];
+	int ifindex;
+	int fd;				/* own socket; -1 if "any" socket */
+	unsigned long long frames;
+	unsigned long long bytes;	/* payload bytes */
+	unsigned long long last_frames;
+	unsigned long long last_bytes;
+	unsigned long long if_start;	/* rx_packets of the interface */
+	unsigned long long if_last;
+	unsigned long long drops;	/* receive buffer overflows */
+	unsigned long long last_drops;
+	struct id_table *ids;		/* only in sequence and stats mode */
+	struct lat_stats *lat;		/* only allocated in latency mode */
+	struct can_ring *ring;		/* only with -M, fd is a packet socket */
+	struct rx_stats stats;		/* loop statistics in thread mode */
+	pthread_t thread;
+};
+
+/* One direction of the bridge mode */
+struct bridge_dir {
+	char name[2 * IFNAMSIZ + 4];
+	int in;				/* socket to receive from */
+	int out;			/* socket to send on */
+	unsigned long long frames;
+	unsigned long long last_frames;
+	unsigned long long rewritten;
+	unsigned long long drops;	/* transmit queue full */
+	struct hist lat;		/* kernel receive to sent */
+};
+
+/* ID rewrite rule of the bridge mode */
+struct rewrite {
+	canid_t from;
+	canid_t to;
+};
+
+static struct rx_stats rx_stats;
+static struct can_if ifs[MAX_IFS];
+static int nifs;
+static int any_fd = -1;			/* socket bound to all interfaces */
+static unsigned long long any_drops;	/* overflows of the "any" socket */
+static unsigned long long last_any_drops;
+static int threads;			/* one receive thread per interface */
+static unsigned long long unknown_if;	/* frames of too many interfaces */
+static struct cap_header *cap;		/* mapped capture file */
+static size_t cap_size;
+static struct cyc_job jobs[MAX_JOBS];
+static int njobs;
+static struct rewrite rewrites[MAX_FILTERS];
+static int nrewrites;
+
+
+/*****************************************************************************
+*** Function:    int parse_filters(char *arg)                              ***
+***                                                                        ***
+*** Parameters:  arg: comma separated list of filters                      ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Parse receive filters for CAN_RAW_FILTER and CAN_RAW_ERR_FILTER:       ***
+***   id:mask  receive if (received_id & mask) == (id & mask)              ***
+***   id~mask  receive if (received_id & mask) != (id & mask)              ***
+***   #mask    receive error frames of the classes in mask                 ***
+*** IDs above 0x7FF are extended IDs; for them CAN_EFF_FLAG is added to    ***
+*** ID and mask, so they do not match standard frames.                     ***
+*****************************************************************************/
+static int parse_filters(char *arg)
+{
+	struct can_filter *f;
+	unsigned long id, mask;
+	char *tok, *end;
+	char op;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (*tok == '#') {
+			err_mask = strtoul(tok + 1, &end, 16);
+			if ((end == tok + 1) || *end)
+				return 1;
+			continue;
+		}
+		if (nfilters >= MAX_FILTERS) {
+			fprintf(stderr, "too many filters (max. %d)\n",
+				MAX_FILTERS);
+			return 1;
+		}
+		f = &filters[nfilters++];
+		id = strtoul(tok, &end, 16);
+		op = *end;
+		if ((end == tok) || ((op != ':') && (op != '~'))
+		    || (id > CAN_EFF_MASK))
+			return 1;
+		tok = end + 1;
+		mask = strtoul(tok, &end, 16);
+		if ((end == tok) || *end
+		    || (mask & ~(unsigned long)(CAN_EFF_FLAG | CAN_RTR_FLAG
+						| CAN_EFF_MASK)))
+			return 1;
+		f->can_id = id;
+		f->can_mask = mask;
+		if (f->can_id > CAN_SFF_MASK) {
+			f->can_id |= CAN_EFF_FLAG;
+			f->can_mask |= CAN_EFF_FLAG;
+		}
+		if (op == '~')
+			f->can_id |= CAN_INV_FILTER;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int read_if_counter(const char *port,                     ***
+***                                  unsigned long long *value)            ***
+***                                                                        ***
+*** Parameters:  port:  name of the can device                             ***
+***              value: receives the rx_packets counter of the interface   ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Read the number of frames the interface has received. Compared with    ***
+*** the frames that arrive at the socket, this shows how many frames the   ***
+*** kernel filters have dropped before they were copied to user space.     ***
+*****************************************************************************/
+static int read_if_counter(const char *port, unsigned long long *value)
+{
+	char path[64];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), IF_STATS_PATH, port);
+	f = fopen(path, "r");
+	if (!f)
+		return 1;
+	ret = fscanf(f, "%llu", value);
+	fclose(f);
+
+	return (ret == 1) ? 0 : 1;
+}
+
+
+/*****************************************************************************
+*** Function:    int set_rcvbuf(int fd, const char *port)                  ***
+***                                                                        ***
+*** Parameters:  fd:   socket                                              ***
+***              port: name of the can device, for the message             ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Size the receive buffer to hold <rcvbuf_ms> of frames at the expected  ***
+*** rate of -B. The kernel doubles the requested value for its overhead    ***
+*** and charges the full skb per frame, so half of the frame cost is       ***
+*** requested. SO_RCVBUFFORCE (root only) may exceed rmem_max, otherwise   ***
+*** SO_RCVBUF is limited to it. The granted size is shown.                 ***
+*****************************************************************************/
+static int set_rcvbuf(int fd, const char *port)
+{
+	unsigned long long want;
+	int size, granted;
+	socklen_t len = sizeof(granted);
+
+	want = (unsigned long long)rcvbuf_rate * rcvbuf_ms / 1000
+		* RCVBUF_FRAME_COST / 2;
+	if (want > 0x3FFFFFFF)
+		want = 0x3FFFFFFF;
+	size = want;
+	if ((setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+			sizeof(size)) < 0)
+	    && (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size,
+			   sizeof(size)) < 0)) {
+		perror("failed to set receive buffer");
+		return 1;
+	}
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &granted, &len) < 0) {
+		perror("failed to get receive buffer");
+		return 1;
+	}
+	fprintf(stderr, "%s: receive buffer %d bytes, about %d frames or "
+		"%.0f ms at %lu frames/s\n", port, granted,
+		granted / RCVBUF_FRAME_COST,
+		1000.0 * granted / RCVBUF_FRAME_COST / rcvbuf_rate,
+		rcvbuf_rate);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_isotp_opts(char *arg)                           ***
+***                                                                        ***
+*** Parameters:  arg: bs[:stmin[:pad]]                                     ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Parse the ISO-TP flow control options. STmin is given in microseconds  ***
+*** and coded like in the flow control frame: 0xF1..0xF9 for 100..900 us,  ***
+*** 0..127 for whole milliseconds.                                         ***
+*****************************************************************************/
+static int parse_isotp_opts(char *arg)
+{
+	unsigned long val, stmin;
+	char *end;
+
+	/* strtoul() takes "-1" as ULONG_MAX, so the range checks catch it */
+	val = strtoul(arg, &end, 0);
+	if ((end == arg) || (val > 0xFF))
+		return 1;
+	isotp_bs = val;
+	if (*end == ':') {
+		arg = end + 1;
+		stmin = strtoul(arg, &end, 0);
+		if (end == arg)
+			return 1;
+		if ((stmin > 0) && (stmin < 1000)) {
+			if (stmin % 100)
+				return 1;
+			isotp_stmin = 0xF0 + stmin / 100;
+		} else {
+			if ((stmin % 1000) || (stmin > 127000))
+				return 1;
+			isotp_stmin = stmin / 1000;
+		}
+	}
+	if (*end == ':') {
+		arg = end + 1;
+		val = strtoul(arg, &end, 16);
+		if ((end == arg) || (val > 0xFF))
+			return 1;
+		isotp_pad = val;
+	}
+
+	return *end != '\0';
+}
+
+
+/*****************************************************************************
+*** Function:    int open_socket(const char *port)                         ***
+***                                                                        ***
+*** Parameters:  port: name of the can device; "any" for all devices       ***
+***                                                                        ***
+*** Return:      Socket; -1: Failure                                       ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** This function open and initailize a can socket.                        ***
+*****************************************************************************/
+static int open_socket(const char *port)
+{
+	struct ifreq ifr;
+	struct sockaddr_can addr;
+	int one = 1;
+	int fd;
+
+	/* open socket */
+	fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if(fd < 0) {
+		fprintf(stderr, "failed to open socket\n");
+		return -1;
+	}
+
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = 0;
+	if (strcmp(port, "any") != 0) {
+		strncpy(ifr.ifr_name, port, IFNAMSIZ - 1);
+		ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+		if(ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+			fprintf(stderr, "failed to initialize socket\n");
+			close(fd);
+			return -1;
+		}
+		addr.can_ifindex = ifr.ifr_ifindex;
+	}
+
+	/* Receive and send CAN FD frames in addition to classic frames */
+	if (fd_mode) {
+		if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &one,
+			       sizeof(one)) < 0) {
+			perror("failed to enable CAN FD frames");
+			close(fd);
+			return -1;
+		}
+	}
+
+	/* Kernel receive time stamp for each frame, hardware time stamps
+	   if the driver supports them */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+		perror("failed to enable time stamps");
+		close(fd);
+		return -1;
+	}
+	if (hw_stamps) {
+		int flags = SOF_TIMESTAMPING_RX_HARDWARE
+			| SOF_TIMESTAMPING_RAW_HARDWARE
+			| SOF_TIMESTAMPING_RX_SOFTWARE
+			| SOF_TIMESTAMPING_SOFTWARE;
+		struct hwtstamp_config hwcfg;
+
+		memset(&hwcfg, 0, sizeof(hwcfg));
+		hwcfg.tx_type = HWTSTAMP_TX_OFF;
+		hwcfg.rx_filter = HWTSTAMP_FILTER_ALL;
+		ifr.ifr_data = (void *)&hwcfg;
+		if (addr.can_ifindex && (ioctl(fd, SIOCSHWTSTAMP, &ifr) < 0))
+			fprintf(stderr, "%s: no hardware time stamps, using "
+				"software time stamps\n", port);
+		if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+			       sizeof(flags)) < 0) {
+			perror("failed to enable SO_TIMESTAMPING");
+			close(fd);
+			return -1;
+		}
+	}
+
+	/* Let the kernel drop all frames we are not interested in */
+	if (nfilters && setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+				   nfilters * sizeof(struct can_filter)) < 0) {
+		perror("failed to set filters");
+		close(fd);
+		return -1;
+	}
+	if (err_mask && setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
+				   &err_mask, sizeof(err_mask)) < 0) {
+		perror("failed to set error filter");
+		close(fd);
+		return -1;
+	}
+
+	/* Count the frames the kernel drops because the receive buffer is
+	   full; the counter comes with every received message */
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+		perror("failed to enable SO_RXQ_OVFL");
+	if (rcvbuf_rate && set_rcvbuf(fd, port))
+		fprintf(stderr, "%s: keeping the default receive buffer\n",
+			port);
+
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "failed to bind socket\n");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*****************************************************************************
+*** Function:    int open_port(const char *port)                           ***
+***                                                                        ***
+*** Parameters:  port: name of the can device                              ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** This function open and initailize the can socket of the send modes.    ***
+*****************************************************************************/
+int open_port(const char *port)
+{
+	soc = open_socket(port);
+
+	return (soc < 0) ? 1 : 0;
+}
+
+
+/*****************************************************************************
+*** Function:    struct can_if *add_if(const char *name, int ifindex,      ***
+***                                    int fd)                             ***
+***                                                                        ***
+*** Parameters:  name:    name of the can device                           ***
+***              ifindex: interface index of the can device                ***
+***              fd:      socket of this device; -1 for the "any" socket   ***
+***                                                                        ***
+*** Return:      New interface entry; NULL if there are too many           ***
+*****************************************************************************/
+static struct can_if *add_if(const char *name, int ifindex, int fd)
+{
+	struct can_if *cif;
+
+	if (nifs >= MAX_IFS)
+		return NULL;
+	cif = &ifs[nifs];
+	strncpy(cif->name, name, IFNAMSIZ - 1);
+	cif->ifindex = ifindex;
+	cif->fd = fd;
+	if (!read_if_counter(name, &cif->if_start))
+		cif->if_last = cif->if_start;
+	if (seq_mode || stats_mode) {
+		cif->ids = calloc(1, sizeof(struct id_table));
+		if (!cif->ids)
+			return NULL;
+	}
+	if (lat_mode) {
+		cif->lat = calloc(1, sizeof(struct lat_stats));
+		if (!cif->lat)
+			return NULL;
+	}
+	nifs++;
+
+	return cif;
+}
+
+
+/*****************************************************************************
+*** Function:    int open_ring(const char *port, struct can_ring **ring)   ***
+***                                                                        ***
+*** Parameters:  port: name of the can device                              ***
+***              ring: receives the mapped ring                            ***
+***                                                                        ***
+*** Return:      Packet socket; -1: Failure                                ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Open a PF_PACKET socket on the interface with a TPACKET_V3 receive     ***
+*** ring that is mapped into the process. The kernel writes the frames     ***
+*** into blocks of the ring and hands over a block when it is full or      ***
+*** RING_TIMEOUT_MS after its first frame; the frames are then read in     ***
+*** place without any system call per frame or batch. CAN receive filters  ***
+*** do not exist for packet sockets, so -f is not used here.               ***
+*****************************************************************************/
+static int open_ring(const char *port, struct can_ring **ring)
+{
+	struct sockaddr_ll addr;
+	struct tpacket_req3 req;
+	struct can_ring *r;
+	int version = TPACKET_V3;
+	int stamps = SOF_TIMESTAMPING_RAW_HARDWARE;
+	int fd;
+
+	fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0) {
+		perror("failed to open packet socket");
+		return -1;
+	}
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)) < 0) {
+		perror("failed to select TPACKET_V3");
+		close(fd);
+		return -1;
+	}
+	if (hw_stamps && (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP, &stamps,
+				     sizeof(stamps)) < 0))
+		fprintf(stderr, "%s: no hardware time stamps, using software "
+			"time stamps\n", port);
+	if (nfilters || err_mask)
+		fprintf(stderr, "%s: receive filters are not used with the "
+			"packet ring\n", port);
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCKS;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCKS;
+	req.tp_retire_blk_tov = RING_TIMEOUT_MS;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("failed to set up the packet ring");
+		close(fd);
+		return -1;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		perror("failed to allocate ring");
+		close(fd);
+		return -1;
+	}
+	r->block_size = RING_BLOCK_SIZE;
+	r->nblocks = RING_BLOCKS;
+	r->size = (size_t)RING_BLOCK_SIZE * RING_BLOCKS;
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r->map == MAP_FAILED) {
+		perror("failed to map the packet ring");
+		free(r);
+		close(fd);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_ALL);
+	addr.sll_ifindex = if_nametoindex(port);
+	if (!addr.sll_ifindex
+	    || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+		perror("failed to bind packet socket");
+		munmap(r->map, r->size);
+		free(r);
+		close(fd);
+		return -1;
+	}
+	*ring = r;
+
+	return fd;
+}
+
+
+/*****************************************************************************
+*** Function:    void ring_drops(struct can_if *cif)                       ***
+***                                                                        ***
+*** Parameters:  cif: interface with a packet ring                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Add the frames the kernel has dropped because the ring was full. The   ***
+*** kernel resets its counters on every read.                              ***
+*****************************************************************************/
+static void ring_drops(struct can_if *cif)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (cif->ring && !getsockopt(cif->fd, SOL_PACKET, PACKET_STATISTICS,
+				     &st, &len))
+		cif->drops += st.tp_drops;
+}
+
+
+/*****************************************************************************
+*** Function:    int open_ports(char *ports)                               ***
+***                                                                        ***
+*** Parameters:  ports: comma separated list of can devices or "any"       ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Open the sockets of the read mode. Each device of the list gets its    ***
+*** own socket. With "any", one socket is bound to interface index 0 and   ***
+*** receives from all CAN devices; the devices are added to ifs[] when the ***
+*** first frame arrives from them.                                         ***
+*****************************************************************************/
+static int open_ports(char *ports)
+{
+	struct can_ring *ring = NULL;
+	struct can_if *cif;
+	char *name;
+	int fd;
+
+	if (strcmp(ports, "any") == 0) {
+		if (ring_mode) {
+			fprintf(stderr, "packet ring needs a list of ports\n");
+			return 1;
+		}
+		any_fd = open_socket(ports);
+		return (any_fd < 0) ? 1 : 0;
+	}
+
+	for (name = strtok(ports, ","); name; name = strtok(NULL, ",")) {
+		fd = ring_mode ? open_ring(name, &ring) : open_socket(name);
+		if (fd < 0)
+			return 1;
+		cif = add_if(name, if_nametoindex(name), fd);
+		if (!cif) {
+			fprintf(stderr, "failed to add %s (max. %d devices)\n",
+				name, MAX_IFS);
+			if (ring) {
+				munmap(ring->map, ring->size);
+				free(ring);
+			}
+			close(fd);
+			return 1;
+		}
+		cif->ring = ring;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void stop_loop(int sig)                                   ***
+***                                                                        ***
+*** Parameters:  sig: number of the received signal                        ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Signal handler for SIGINT/SIGTERM. Let the receive or send loop        ***
+*** terminate, so that the statistics can be shown.                        ***
+*****************************************************************************/
+static void stop_loop(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void catch_signals(void)                                  ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Install stop_loop() for SIGINT and SIGTERM. No SA_RESTART, so blocking ***
+*** calls return with EINTR and the loops can check the running flag.      ***
+*****************************************************************************/
+static void catch_signals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_loop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+
+/*****************************************************************************
+*** Function:    uint64_t now_ns(void)                                     ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      Current CLOCK_MONOTONIC time in nanoseconds               ***
+*****************************************************************************/
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*****************************************************************************
+*** Function:    void sleep_until(uint64_t deadline)                       ***
+***                                                                        ***
+*** Parameters:  deadline: absolute CLOCK_MONOTONIC time in nanoseconds    ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Sleep until the given absolute time. Absolute deadlines do not drift,  ***
+*** no matter how long the work between two deadlines took.                ***
+*****************************************************************************/
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+
+/*****************************************************************************
+*** Function:    uint64_t realtime_ns(void)                                ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      Current CLOCK_REALTIME time in nanoseconds, the clock of  ***
+***              the kernel receive timestamps                             ***
+*****************************************************************************/
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*****************************************************************************
+*** Function:    unsigned int hist_bucket(uint64_t value)                  ***
+***                                                                        ***
+*** Parameters:  value: value to sort in                                   ***
+***                                                                        ***
+*** Return:      Bucket index of the log-linear histogram                  ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Values below HIST_SUB have their own bucket. Above, each power of two  ***
+*** is split into HIST_SUB linear buckets, so the relative error is below  ***
+*** 1/HIST_SUB over the whole 64-bit range with a few KB of memory.        ***
+*****************************************************************************/
+static unsigned int hist_bucket(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < HIST_SUB)
+		return value;
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+
+	return (shift + 1) * HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+
+/*****************************************************************************
+*** Function:    uint64_t hist_value(unsigned int bucket)                  ***
+***                                                                        ***
+*** Parameters:  bucket: bucket index of the log-linear histogram          ***
+***                                                                        ***
+*** Return:      Middle of the value range of this bucket                  ***
+*****************************************************************************/
+static uint64_t hist_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+	shift = bucket / HIST_SUB - 1;
+
+	return (((uint64_t)HIST_SUB + bucket % HIST_SUB) << shift)
+		+ ((1ULL << shift) >> 1);
+}
+
+
+/*****************************************************************************
+*** Function:    void hist_add(struct hist *h, uint64_t value)             ***
+***                                                                        ***
+*** Parameters:  h:     histogram                                          ***
+***              value: value to add                                       ***
+***                                                                        ***
+*** Return:      -                                                         ***
+*****************************************************************************/
+static void hist_add(struct hist *h, uint64_t value)
+{
+	if (!h->count || (value < h->min))
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->sum += value;
+	h->count++;
+	h->buckets[hist_bucket(value)]++;
+}
+
+
+/*****************************************************************************
+*** Function:    uint64_t hist_quantile(struct hist *h, double q)          ***
+***                                                                        ***
+*** Parameters:  h: histogram                                              ***
+***              q: quantile (0.0 .. 1.0)                                  ***
+***                                                                        ***
+*** Return:      Value below which the fraction q of all values lies       ***
+*****************************************************************************/
+static uint64_t hist_quantile(struct hist *h, double q)
+{
+	unsigned long long rank, seen = 0;
+	unsigned int i;
+
+	rank = (unsigned long long)(q * h->count);
+	if (rank >= h->count)
+		rank = h->count - 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank)
+			break;
+	}
+	if (i >= HIST_BUCKETS)
+		return h->max;
+
+	/* The exact extremes are known */
+	if (hist_value(i) < h->min)
+		return h->min;
+	if (hist_value(i) > h->max)
+		return h->max;
+
+	return hist_value(i);
+}
+
+
+/*****************************************************************************
+*** Function:    void hist_show(const char *name, struct hist *h)          ***
+***                                                                        ***
+*** Parameters:  name: name of the measured value                          ***
+***              h:    histogram                                           ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show count, min, mean, p50, p99, p99.9 and max in microseconds.        ***
+*****************************************************************************/
+static void hist_show(const char *name, struct hist *h)
+{
+	if (!h->count) {
+		fprintf(stderr, "%-12s no values\n", name);
+		return;
+	}
+	fprintf(stderr, "%-12s n=%llu min=%.1f mean=%.1f p50=%.1f p99=%.1f "
+		"p99.9=%.1f max=%.1f us\n", name, h->count, h->min / 1e3,
+		(double)h->sum / h->count / 1e3, hist_quantile(h, 0.5) / 1e3,
+		hist_quantile(h, 0.99) / 1e3, hist_quantile(h, 0.999) / 1e3,
+		h->max / 1e3);
+}
+
+
+/*****************************************************************************
+*** Function:    uint32_t xorshift32(uint32_t x)                           ***
+***                                                                        ***
+*** Parameters:  x: previous value, must not be 0                          ***
+***                                                                        ***
+*** Return:      Next pseudo random value                                  ***
+*****************************************************************************/
+static uint32_t xorshift32(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return x;
+}
+
+
+/*****************************************************************************
+*** Function:    uint32_t seq_seed(canid_t id, uint32_t seq)               ***
+***                                                                        ***
+*** Parameters:  id:  CAN ID of the frame                                  ***
+***              seq: sequence number of the frame                         ***
+***                                                                        ***
+*** Return:      Start value of the payload generator for this frame       ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** The payload is a xorshift32 sequence seeded from ID and sequence       ***
+*** number. The receiver can recompute the payload of each frame           ***
+*** independently of all other frames, so lost or reordered frames do not  ***
+*** disturb the check.                                                     ***
+*****************************************************************************/
+static uint32_t seq_seed(canid_t id, uint32_t seq)
+{
+	uint32_t x = (seq * 0x9E3779B1U) ^ id;
+
+	return x ? x : 1;
+}
+
+
+/*****************************************************************************
+*** Function:    unsigned int fd_round_len(unsigned int len)               ***
+***                                                                        ***
+*** Parameters:  len: wanted payload length                                ***
+***                                                                        ***
+*** Return:      Next valid CAN FD payload length (0..8, 12, 16, 20, 24,   ***
+***              32, 48, 64)                                               ***
+*****************************************************************************/
+static unsigned int fd_round_len(unsigned int len)
+{
+	static const unsigned char lens[] = {12, 16, 20, 24, 32, 48, 64};
+	unsigned int i;
+
+	if (len <= CAN_MAX_DLEN)
+		return len;
+	for (i = 0; i < sizeof(lens) - 1; i++) {
+		if (len <= lens[i])
+			break;
+	}
+
+	return lens[i];
+}
+
+
+/*****************************************************************************
+*** Function:    void make_frame(struct canfd_frame *frame,                ***
+***                              unsigned long long n)                     ***
+***                                                                        ***
+*** Parameters:  frame: frame to fill                                      ***
+***              n:     number of the frame since start                    ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Fill in a random frame or, in sequence mode, a test frame. Test frames ***
+*** cycle through the IDs seq_id_first..seq_id_last and carry the 32-bit   ***
+*** sequence number of their ID in bytes 0..3, followed by the xorshift32  ***
+*** words of seq_seed(), all little endian. Classic test frames have 8     ***
+*** bytes, FD frames fd_len bytes. In FD mode, frames are sent with bit    ***
+*** rate switch (BRS).                                                     ***
+*****************************************************************************/
+static void make_frame(struct canfd_frame *frame, unsigned long long n)
+{
+	unsigned int nids = seq_id_last - seq_id_first + 1;
+	uint32_t seq, val;
+	unsigned int i;
+
+	memset(frame, 0, sizeof(*frame));
+	if (fd_mode)
+		frame->flags = CANFD_BRS;
+	if (!seq_mode) {
+		frame->can_id = rand() % 1000;
+		frame->len = fd_mode ? fd_len : (unsigned int)rand() % 9;
+		for (i = 0; i < frame->len; i++)
+			frame->data[i] = rand() % 255;
+		return;
+	}
+
+	frame->can_id = seq_id_first + n % nids;
+	seq = n / nids;
+	val = seq_seed(frame->can_id, seq);
+	if (frame->can_id > CAN_SFF_MASK)
+		frame->can_id |= CAN_EFF_FLAG;
+	frame->len = fd_mode ? fd_len : CAN_MAX_DLEN;
+	for (i = 0; i < 4; i++)
+		frame->data[i] = seq >> (8 * i);
+	for (i = 4; i < frame->len; i++) {
+		if (!(i & 3))
+			val = xorshift32(val);
+		frame->data[i] = val >> (8 * (i & 3));
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    int send_port(int send_start)                             ***
+***                                                                        ***
+*** Parameters:  send_start: flag to check how much frames to send (1 or   ***
+***              endless loop)                                             ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** This function sends one or more can frames to the bus.                 ***
+*****************************************************************************/
+int send_port(int send_start)
+{
+	struct canfd_frame frame;
+	unsigned long long n = 0;
+	int mtu = fd_mode ? CANFD_MTU : CAN_MTU;
+	int retval;
+
+	srand(time(NULL));
+	while(1) {
+		make_frame(&frame, n++);
+		retval = write(soc, &frame, mtu);
+		if (retval != mtu) {
+			fprintf(stderr, "failed to write can frame\n");
+			return 1;
+		}
+		if(send_start == 0)
+			break;
+
+		usleep(200 * u_to_m);
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int send_batch(int fd, struct mmsghdr *msgs,              ***
+***                             unsigned int n,                            ***
+***                             unsigned long long *enobufs)               ***
+***                                                                        ***
+*** Parameters:  fd:      socket to send on                                ***
+***              msgs:    messages with one frame each                     ***
+***              n:       number of messages                               ***
+***              enobufs: counter for the ENOBUFS events                   ***
+***                                                                        ***
+*** Return:      Number of sent frames (less than n if stopped); -1: Error ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Send frames with sendmmsg(). If the transmit queue is full, the kernel ***
+*** returns ENOBUFS; these events are counted and the rest of the batch is ***
+*** sent again a bit later.                                                ***
+*****************************************************************************/
+static int send_batch(int fd, struct mmsghdr *msgs, unsigned int n,
+		      unsigned long long *enobufs)
+{
+	unsigned int done = 0;
+	int ret;
+
+	while (running && (done < n)) {
+		ret = sendmmsg(fd, &msgs[done], n - done, 0);
+		if (ret > 0) {
+			done += ret;
+			continue;
+		}
+		if ((errno == ENOBUFS) || (errno == EAGAIN)) {
+			/* TX queue full, give the controller time */
+			(*enobufs)++;
+			sleep_until(now_ns() + 100000);
+		} else if (errno != EINTR) {
+			perror("failed to write can frames");
+			return -1;
+		}
+	}
+
+	return done;
+}
+
+
+/*****************************************************************************
+*** Function:    int flood_port(void)                                      ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Load generator for bus saturation tests. Frames are sent in batches    ***
+*** with sendmmsg(). If a rate is given, each batch is paced to an         ***
+*** absolute deadline, so the average rate stays exact even if single      ***
+*** batches are late. A batch never covers more than 1 ms of traffic.      ***
+*****************************************************************************/
+int flood_port(void)
+{
+	struct canfd_frame frames[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	struct mmsghdr msgs[MAX_BATCH];
+	unsigned long long sent = 0, enobufs = 0;
+	unsigned long long last_sent = 0, last_enobufs = 0;
+	unsigned long long bytes = 0, last_bytes = 0;
+	unsigned int n = batch;
+	unsigned int i;
+	uint64_t start, now, next_report;
+	int done;
+
+	if (rate && (rate / 1000 < n))
+		n = (rate / 1000) ? rate / 1000 : 1;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MAX_BATCH; i++) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = fd_mode ? CANFD_MTU : CAN_MTU;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	catch_signals();
+	srand(time(NULL));
+	start = now_ns();
+	next_report = start + 1000000000ULL;
+	while (running && (!count || (sent < count))) {
+		if (count && (count - sent < n))
+			n = count - sent;
+		for (i = 0; i < n; i++)
+			make_frame(&frames[i], sent + i);
+
+		done = send_batch(soc, msgs, n, &enobufs);
+		if (done < 0)
+			return 1;
+		sent += done;
+		for (i = 0; i < (unsigned int)done; i++)
+			bytes += frames[i].len;
+
+		now = now_ns();
+		if (now >= next_report) {
+			fprintf(stderr, "tx: %llu frames/s, %llu bytes/s, "
+				"%llu ENOBUFS\n", sent - last_sent,
+				bytes - last_bytes, enobufs - last_enobufs);
+			last_sent = sent;
+			last_bytes = bytes;
+			last_enobufs = enobufs;
+			next_report += 1000000000ULL;
+		}
+		if (rate)
+			sleep_until(start + sent * 1000000000ULL / rate);
+	}
+
+	now = now_ns();
+	fprintf(stderr, "\n%llu frames in %.3fs: %.0f frames/s, %.0f bytes/s, "
+		"%llu ENOBUFS\n", sent, (now - start) / 1e9,
+		sent * 1e9 / (now - start), bytes * 1e9 / (now - start),
+		enobufs);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int replay_port(const char *file)                         ***
+***                                                                        ***
+*** Parameters:  file: name of the capture file                            ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Send all records of a capture file from the oldest to the newest one.  ***
+*** Each frame is sent at its original time relative to the first frame,   ***
+*** using absolute deadlines; frames that are due are collected and sent   ***
+*** with one sendmmsg() call. With "-r max", the frames are sent as fast   ***
+*** as possible. All frames go out on the given port, regardless of the    ***
+*** interface they were captured on. Records with a length that does not   ***
+*** fit their record or frame type are skipped and counted.                ***
+*****************************************************************************/
+int replay_port(const char *file)
+{
+	struct canfd_frame frames[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	struct mmsghdr msgs[MAX_BATCH];
+	unsigned long long sent = 0, enobufs = 0, bad = 0;
+	struct cap_header *hdr;
+	struct cap_record *rec;
+	struct stat st;
+	uint64_t first, k, t0 = 0, start, now, deadline;
+	unsigned int n = 0, i;
+	int fd, done;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		perror("Can not open capture file");
+		return 1;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size < CAP_HDR_SIZE)) {
+		fprintf(stderr, "Bad capture file\n");
+		close(fd);
+		return 1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("Can not map capture file");
+		return 1;
+	}
+	if ((hdr->magic != CAP_MAGIC) || (hdr->version != CAP_VERSION)
+	    || (hdr->rec_size < sizeof(struct cap_record) + CAN_MAX_DLEN)
+	    || (hdr->rec_size > sizeof(struct cap_record) + CANFD_MAX_DLEN)
+	    || !hdr->capacity
+	    || (hdr->capacity
+		> (uint64_t)(st.st_size - CAP_HDR_SIZE) / hdr->rec_size)) {
+		fprintf(stderr, "Bad capture file\n");
+		munmap(hdr, st.st_size);
+		return 1;
+	}
+
+	/* FD records need an FD socket */
+	if (!fd_mode && (hdr->rec_size > sizeof(struct cap_record)
+			 + CAN_MAX_DLEN)) {
+		int enable = 1;
+
+		setsockopt(soc, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable,
+			   sizeof(enable));
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MAX_BATCH; i++) {
+		iov[i].iov_base = &frames[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	catch_signals();
+	first = (hdr->head > hdr->capacity) ? hdr->head - hdr->capacity : 0;
+	fprintf(stderr, "replay: %llu records\n",
+		(unsigned long long)(hdr->head - first));
+	start = now = now_ns();
+	for (k = first; running && (k < hdr->head); k++) {
+		rec = (struct cap_record *)((char *)hdr + CAP_HDR_SIZE
+			+ (k % hdr->capacity) * hdr->rec_size);
+		if (!rate_max) {
+			if (k == first)
+				t0 = rec->ts;
+			deadline = start + ((rec->ts > t0) ? rec->ts - t0 : 0);
+			if (deadline > now) {
+				/* Send what is due, then wait for this frame */
+				done = send_batch(soc, msgs, n, &enobufs);
+				if (done < 0)
+					break;
+				sent += done;
+				n = 0;
+				sleep_until(deadline);
+				now = now_ns();
+			}
+		}
+
+		/* Skip records that would not fit into a frame */
+		if ((rec->len > hdr->rec_size - sizeof(struct cap_record))
+		    || (rec->len > ((rec->flags & CAP_FD) ? CANFD_MAX_DLEN
+				    : CAN_MAX_DLEN))) {
+			bad++;
+			continue;
+		}
+
+		memset(&frames[n], 0, sizeof(frames[n]));
+		frames[n].can_id = rec->can_id;
+		frames[n].len = rec->len;
+		frames[n].flags = rec->flags & ~CAP_FD;
+		memcpy(frames[n].data, rec->data, rec->len);
+		iov[n].iov_len = (rec->flags & CAP_FD) ? CANFD_MTU : CAN_MTU;
+		if (++n == batch) {
+			done = send_batch(soc, msgs, n, &enobufs);
+			if (done < 0)
+				break;
+			sent += done;
+			n = 0;
+			now = now_ns();
+		}
+	}
+	if (running && n) {
+		done = send_batch(soc, msgs, n, &enobufs);
+		if (done > 0)
+			sent += done;
+	}
+
+	now = now_ns();
+	fprintf(stderr, "%llu frames in %.3fs: %.0f frames/s, %llu ENOBUFS\n",
+		sent, (now - start) / 1e9, sent * 1e9 / (now - start), enobufs);
+	if (bad)
+		fprintf(stderr, "%llu bad records skipped\n", bad);
+	munmap(hdr, st.st_size);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    struct id_entry *id_lookup(struct id_table *t,            ***
+***                                           canid_t id)                  ***
+***                                                                        ***
+*** Parameters:  t:  per-ID table                                          ***
+***              id: CAN ID including CAN_EFF_FLAG                         ***
+***                                                                        ***
+*** Return:      Entry for this ID; NULL if the extended ID hash is full   ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Standard IDs are a direct index into the std[] array. Extended IDs use ***
+*** an open addressing hash with linear probing; entries are never         ***
+*** removed, so the lookup cost stays bounded and no memory is allocated   ***
+*** at run time.                                                           ***
+*****************************************************************************/
+static struct id_entry *id_lookup(struct id_table *t, canid_t id)
+{
+	struct id_entry *e;
+	unsigned int h, i;
+
+	if (!(id & CAN_EFF_FLAG)) {
+		e = &t->std[id & CAN_SFF_MASK];
+		e->id = id & CAN_SFF_MASK;
+		return e;
+	}
+
+	id &= CAN_EFF_MASK | CAN_EFF_FLAG;
+	h = (id * 0x9E3779B1U) >> (32 - EXT_HASH_BITS);
+	for (i = 0; i < EXT_HASH_SIZE; i++) {
+		e = &t->ext[(h + i) & (EXT_HASH_SIZE - 1)];
+		if (e->id_used && (e->id == id))
+			return e;
+		if (!e->id_used) {
+			e->id_used = 1;
+			e->id = id;
+			return e;
+		}
+	}
+	t->ext_overflow++;
+
+	return NULL;
+}
+
+
+/*****************************************************************************
+*** Function:    void check_frame(struct id_table *t,                      ***
+***                               struct canfd_frame *frame)               ***
+***                                                                        ***
+*** Parameters:  t:     per-ID table of the interface                      ***
+***              frame: received frame                                     ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Check a sequence test frame (see make_frame()). A gap in the sequence  ***
+*** counts the missing frames as lost. The last 64 sequence numbers are    ***
+*** kept as bit mask, so a frame that arrives late is counted as reordered ***
+*** (and no longer as lost) and a frame that is seen twice as duplicate.   ***
+*** Frames older than this window are also counted as reordered and no     ***
+*** longer as lost, as every sequence number behind the expected one was   ***
+*** counted as lost before; only a duplicate that old can not be told      ***
+*** apart. A frame SEQ_RESYNC or more behind is taken as a restart of the  ***
+*** sender: the check synchronizes to it again and counts a resync. A      ***
+*** wrong payload is counted as corrupt.                                   ***
+*****************************************************************************/
+static void check_frame(struct id_table *t, struct canfd_frame *frame)
+{
+	struct id_entry *e;
+	uint32_t seq, val, back, gap;
+	unsigned int i;
+
+	e = id_lookup(t, frame->can_id);
+	if (!e)
+		return;
+	e->frames++;
+
+	if (frame->len < CAN_MAX_DLEN) {
+		e->corrupt++;
+		return;
+	}
+	seq = frame->data[0] | (frame->data[1] << 8)
+		| (frame->data[2] << 16) | ((uint32_t)frame->data[3] << 24);
+	val = seq_seed(frame->can_id & CAN_EFF_MASK, seq);
+	for (i = 4; i < frame->len; i++) {
+		if (!(i & 3))
+			val = xorshift32(val);
+		if (frame->data[i] != (uint8_t)(val >> (8 * (i & 3)))) {
+			e->corrupt++;
+			return;
+		}
+	}
+
+	if (!e->window) {
+		/* First frame of this ID, synchronize */
+		e->next_seq = seq + 1;
+		e->window = 1;
+	} else if (seq == e->next_seq) {
+		e->next_seq++;
+		e->window = (e->window << 1) | 1;
+	} else if ((int32_t)(seq - e->next_seq) > 0) {
+		gap = seq - e->next_seq;
+		e->lost += gap;
+		e->next_seq = seq + 1;
+		if (gap < 63)
+			e->window = (e->window << (gap + 1)) | 1;
+		else
+			e->window = 1;
+	} else {
+		back = e->next_seq - 1 - seq;
+		if (back >= SEQ_RESYNC) {
+			e->next_seq = seq + 1;
+			e->window = 1;
+			e->resync++;
+		} else if (back >= 64) {
+			e->reorder++;
+			if (e->lost)
+				e->lost--;
+		} else if (e->window & (1ULL << back))
+			e->dup++;
+		else {
+			e->window |= 1ULL << back;
+			e->reorder++;
+			if (e->lost)
+				e->lost--;
+		}
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void stats_frame(struct id_table *t,                      ***
+***                               struct canfd_frame *frame, uint64_t ts)  ***
+***                                                                        ***
+*** Parameters:  t:     per-ID table of the interface                      ***
+***              frame: received frame                                     ***
+***              ts:    receive time in ns                                 ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Count a frame in the live statistics of its ID. This is all the work   ***
+*** per frame in stats mode, the table is only drawn once per second.      ***
+*****************************************************************************/
+static void stats_frame(struct id_table *t, struct canfd_frame *frame,
+			uint64_t ts)
+{
+	struct id_entry *e;
+	uint64_t period;
+	unsigned int dlc;
+
+	e = id_lookup(t, frame->can_id);
+	if (!e)
+		return;
+	e->frames++;
+	e->bytes += frame->len;
+	if (e->last_ts && (ts > e->last_ts)) {
+		period = ts - e->last_ts;
+		e->period = period;
+		if (!e->min_period || (period < e->min_period))
+			e->min_period = period;
+		if (period > e->max_period)
+			e->max_period = period;
+	}
+	e->last_ts = ts;
+
+	/* Length to DLC code, FD lengths above 8 use codes 9..15 */
+	if (frame->len <= 8)
+		dlc = frame->len;
+	else if (frame->len <= 24)
+		dlc = 9 + (frame->len - 9) / 4;
+	else
+		dlc = (frame->len <= 32) ? 13 : (frame->len <= 48) ? 14 : 15;
+	e->dlc[dlc]++;
+}
+
+
+/*****************************************************************************
+*** Function:    void sum_ids(struct id_table *t, struct id_entry *sum)    ***
+***                                                                        ***
+*** Parameters:  t:   per-ID table                                         ***
+***              sum: entry where the totals over all IDs are added        ***
+***                                                                        ***
+*** Return:      -                                                         ***
+*****************************************************************************/
+static void sum_ids(struct id_table *t, struct id_entry *sum)
+{
+	struct id_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < STD_IDS + EXT_HASH_SIZE; i++) {
+		e = (i < STD_IDS) ? &t->std[i] : &t->ext[i - STD_IDS];
+		sum->frames += e->frames;
+		sum->lost += e->lost;
+		sum->dup += e->dup;
+		sum->reorder += e->reorder;
+		sum->corrupt += e->corrupt;
+		sum->resync += e->resync;
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void show_ids(struct id_table *t)                         ***
+***                                                                        ***
+*** Parameters:  t: per-ID table                                           ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show the sequence check results of all IDs that were received.         ***
+*****************************************************************************/
+static void show_ids(struct id_table *t)
+{
+	struct id_entry *e;
+	unsigned int i;
+
+	fprintf(stderr, "ID               frames        lost         dup"
+		"     reorder     corrupt      resync\n");
+	for (i = 0; i < STD_IDS + EXT_HASH_SIZE; i++) {
+		e = (i < STD_IDS) ? &t->std[i] : &t->ext[i - STD_IDS];
+		if (!e->frames)
+			continue;
+		if (e->id & CAN_EFF_FLAG)
+			fprintf(stderr, "%08X", e->id & CAN_EFF_MASK);
+		else
+			fprintf(stderr, "%03X     ", e->id);
+		fprintf(stderr, " %12llu %11llu %11llu %11llu %11llu %11llu\n",
+			e->frames, e->lost, e->dup, e->reorder, e->corrupt,
+			e->resync);
+	}
+	if (t->ext_overflow)
+		fprintf(stderr, "%llu frames with extended IDs not checked, "
+			"table full\n", t->ext_overflow);
+}
+
+
+/*****************************************************************************
+*** Function:    void show_stats(struct can_if *cif)                       ***
+***                                                                        ***
+*** Parameters:  cif: interface                                            ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show the live statistics of all IDs seen on an interface: frames,      ***
+*** frames/s since the last call, bytes, last/min/max period in ms and the ***
+*** DLC histogram as dlc:frames pairs.                                     ***
+*****************************************************************************/
+static void show_stats(struct can_if *cif)
+{
+	struct id_table *t = cif->ids;
+	struct id_entry *e;
+	unsigned int i, k;
+
+	fprintf(stderr, "%-8s ID            frames  frames/s       bytes"
+		"   last ms    min ms    max ms  dlc:frames\n", cif->name);
+	for (i = 0; i < STD_IDS + EXT_HASH_SIZE; i++) {
+		e = (i < STD_IDS) ? &t->std[i] : &t->ext[i - STD_IDS];
+		if (!e->frames)
+			continue;
+		if (e->id & CAN_EFF_FLAG)
+			fprintf(stderr, "         %08X", e->id & CAN_EFF_MASK);
+		else
+			fprintf(stderr, "         %03X     ", e->id);
+		fprintf(stderr, " %12llu %9llu %11llu %9.3f %9.3f %9.3f ",
+			e->frames, e->frames - e->last_frames, e->bytes,
+			e->period / 1e6, e->min_period / 1e6,
+			e->max_period / 1e6);
+		for (k = 0; k < 16; k++)
+			if (e->dlc[k])
+				fprintf(stderr, " %u:%u", k, e->dlc[k]);
+		fprintf(stderr, "\n");
+		e->last_frames = e->frames;
+	}
+	if (t->ext_overflow)
+		fprintf(stderr, "%llu frames with extended IDs not counted, "
+			"table full\n", t->ext_overflow);
+}
+
+
+/*****************************************************************************
+*** Function:    struct can_if *find_if(int ifindex)                       ***
+***                                                                        ***
+*** Parameters:  ifindex: interface index from the source address          ***
+***                                                                        ***
+*** Return:      Interface entry; NULL if unknown and the table is full    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Find the interface a frame was received from. Consecutive frames       ***
+*** usually come from the same interface, so the last hit is tried first.  ***
+*** New interfaces can only appear on the "any" socket, which is never     ***
+*** served by more than one thread.                                        ***
+*****************************************************************************/
+static struct can_if *find_if(int ifindex)
+{
+	static __thread struct can_if *last;
+	char name[IF_NAMESIZE];
+	int i;
+
+	if (last && (last->ifindex == ifindex))
+		return last;
+	for (i = 0; i < nifs; i++) {
+		if (ifs[i].ifindex == ifindex) {
+			last = &ifs[i];
+			return last;
+		}
+	}
+	if ((any_fd < 0) || !if_indextoname(ifindex, name))
+		return NULL;
+	last = add_if(name, ifindex, -1);
+
+	return last;
+}
+
+
+/*****************************************************************************
+*** Function:    int open_capture(const char *file)                        ***
+***                                                                        ***
+*** Parameters:  file: name of the capture file                            ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Create the capture file with the full size of the ring, so no blocks   ***
+*** have to be allocated while capturing, and map it into memory. Records  ***
+*** have room for 8 data bytes, or for 64 bytes in FD mode.                ***
+*****************************************************************************/
+static int open_capture(const char *file)
+{
+	uint32_t rec_size;
+	uint64_t capacity;
+	int fd, ret;
+
+	rec_size = sizeof(struct cap_record)
+		+ (fd_mode ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+	capacity = ((uint64_t)cap_mb * 1024 * 1024 - CAP_HDR_SIZE) / rec_size;
+	cap_size = CAP_HDR_SIZE + capacity * rec_size;
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Can not create capture file");
+		return 1;
+	}
+	ret = posix_fallocate(fd, 0, cap_size);
+	if (ret) {
+		errno = ret;
+		perror("Can not allocate capture file");
+		close(fd);
+		return 1;
+	}
+	cap = mmap(NULL, cap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (cap == MAP_FAILED) {
+		cap = NULL;
+		perror("Can not map capture file");
+		return 1;
+	}
+
+	cap->version = CAP_VERSION;
+	cap->rec_size = rec_size;
+	cap->capacity = capacity;
+	cap->head = 0;
+	cap->magic = CAP_MAGIC;
+	fprintf(stderr, "capture: %llu records of %u bytes\n",
+		(unsigned long long)capacity, rec_size);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void capture_frame(struct can_if *cif,                    ***
+***                                 struct canfd_frame *frame, int mtu,    ***
+***                                 uint64_t ts)                           ***
+***                                                                        ***
+*** Parameters:  cif:   interface the frame was received from              ***
+***              frame: received frame                                     ***
+***              mtu:   size of the received message                       ***
+***              ts:    receive time in ns                                 ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Append one record to the ring. The slot is reserved with an atomic     ***
+*** increment of the head, so several receive threads can capture into     ***
+*** the same file. When the ring is full, the oldest records are           ***
+*** overwritten.                                                           ***
+*****************************************************************************/
+static void capture_frame(struct can_if *cif, struct canfd_frame *frame,
+			  int mtu, uint64_t ts)
+{
+	struct cap_record *rec;
+	unsigned int slot = cif - ifs;
+	unsigned int len = frame->len;
+	uint64_t n;
+
+	n = __atomic_fetch_add(&cap->head, 1, __ATOMIC_RELAXED);
+	rec = (struct cap_record *)((char *)cap + CAP_HDR_SIZE
+				    + (n % cap->capacity) * cap->rec_size);
+	rec->ts = ts;
+	rec->can_id = frame->can_id;
+	rec->ifslot = slot;
+	rec->flags = frame->flags | ((mtu == CANFD_MTU) ? CAP_FD : 0);
+	if (len > cap->rec_size - sizeof(struct cap_record))
+		len = cap->rec_size - sizeof(struct cap_record);
+	rec->len = len;
+	memcpy(rec->data, frame->data, len);
+}
+
+
+/*****************************************************************************
+*** Function:    void close_capture(void)                                  ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Store the interface names, write the ring back to the file and unmap   ***
+*** it.                                                                    ***
+*****************************************************************************/
+static void close_capture(void)
+{
+	int i;
+
+	if (!cap)
+		return;
+	for (i = 0; i < nifs; i++)
+		strncpy(cap->ifnames[i], ifs[i].name, IFNAMSIZ - 1);
+	cap->nifs = nifs;
+	fprintf(stderr, "capture: %llu records written, %llu kept\n",
+		(unsigned long long)cap->head, (unsigned long long)
+		((cap->head > cap->capacity) ? cap->capacity : cap->head));
+	msync(cap, cap_size, MS_SYNC);
+	munmap(cap, cap_size);
+	cap = NULL;
+}
+
+
+/*****************************************************************************
+*** Function:    void parse_cmsg(struct cmsghdr *cmsg,                     ***
+***                              struct rx_meta *meta)                     ***
+***                                                                        ***
+*** Parameters:  cmsg: ancillary data of a received message                ***
+***              meta: receives the time stamps                            ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** SCM_TIMESTAMPNS holds the kernel receive time. With SO_TIMESTAMPING,   ***
+*** SCM_TIMESTAMPING holds the software time in ts[0] and the raw hardware ***
+*** time in ts[2], which stays 0 if the driver has no hardware stamps.     ***
+*****************************************************************************/
+static void parse_cmsg(struct cmsghdr *cmsg, struct rx_meta *meta)
+{
+	struct timespec *ts;
+
+	if (cmsg->cmsg_level != SOL_SOCKET)
+		return;
+	if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+		memcpy(&meta->drops, CMSG_DATA(cmsg), sizeof(meta->drops));
+		return;
+	}
+	ts = (struct timespec *)CMSG_DATA(cmsg);
+	if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+		meta->sw = (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	} else if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+		if (ts[2].tv_sec || ts[2].tv_nsec)
+			meta->hw = (uint64_t)ts[2].tv_sec * 1000000000ULL
+				+ ts[2].tv_nsec;
+		if (!meta->sw)
+			meta->sw = (uint64_t)ts[0].tv_sec * 1000000000ULL
+				+ ts[0].tv_nsec;
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void cyclic_frame(struct canfd_frame *frame, uint64_t ts) ***
+***                                                                        ***
+*** Parameters:  frame: received copy of a cyclic frame                    ***
+***              ts:    receive time in ns                                 ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Collect the deviation of the measured period from the period of the    ***
+*** job.                                                                   ***
+*****************************************************************************/
+static void cyclic_frame(struct canfd_frame *frame, uint64_t ts)
+{
+	struct cyc_job *job;
+	uint64_t delta;
+	int i;
+
+	for (i = 0; i < njobs; i++) {
+		job = &jobs[i];
+		if (job->frame.can_id != frame->can_id)
+			continue;
+		job->frames++;
+		if (job->last_ts && (ts > job->last_ts)) {
+			delta = ts - job->last_ts;
+			hist_add(&job->jitter, (delta > job->period) ?
+				 delta - job->period : job->period - delta);
+		}
+		job->last_ts = ts;
+		break;
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    void handle_frame(struct can_if *cif,                     ***
+***                                struct canfd_frame *frame, int mtu,     ***
+***                                struct rx_meta *meta)                   ***
+***                                                                        ***
+*** Parameters:  cif:   interface the frame was received from              ***
+***              frame: received frame                                     ***
+***              mtu:   size of the received message                       ***
+***              meta:  time stamps of the frame                           ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Count, check or print one received frame. Classic frames have CAN_MTU, ***
+*** FD frames CANFD_MTU; len is at the same place as can_dlc in struct     ***
+*** can_frame. In latency mode, the inter-arrival time (from the hardware  ***
+*** time stamps if available) and the delay from the kernel time stamp to  ***
+*** user space are collected.                                              ***
+*****************************************************************************/
+static void handle_frame(struct can_if *cif, struct canfd_frame *frame,
+			 int mtu, struct rx_meta *meta)
+{
+	const char *fd = "";
+	uint64_t ts = meta->hw ? meta->hw : meta->sw;
+	int i;
+
+	if (mtu == CANFD_MTU)
+		fd = (frame->flags & CANFD_BRS) ? " FD BRS" : " FD";
+	else if (mtu != CAN_MTU)
+		return;
+	cif->frames++;
+	cif->bytes += frame->len;
+	if (lat_mode) {
+		if (cif->lat->last_ts && (ts > cif->lat->last_ts))
+			hist_add(&cif->lat->arrival, ts - cif->lat->last_ts);
+		cif->lat->last_ts = ts;
+		if (meta->sw && (meta->now > meta->sw))
+			hist_add(&cif->lat->delivery, meta->now - meta->sw);
+	}
+	if (njobs) {
+		cyclic_frame(frame, ts);
+		return;
+	}
+	if (cap) {
+		capture_frame(cif, frame, mtu, ts);
+		return;
+	}
+	if (seq_mode) {
+		check_frame(cif->ids, frame);
+		return;
+	}
+	if (stats_mode) {
+		stats_frame(cif->ids, frame, ts);
+		return;
+	}
+	if (quiet || lat_mode)
+		return;
+
+	/* Keep the lines of several receive threads apart */
+	flockfile(stdout);
+	printf("(%llu.%09llu) %s \t %03X \t [%d]%s \t",
+	       (unsigned long long)(ts / 1000000000ULL),
+	       (unsigned long long)(ts % 1000000000ULL), cif->name,
+	       frame->can_id, frame->len, fd);
+	for (i = 0; i < frame->len; i++)
+		printf("%02X ", frame->data[i]);
+	printf("\n");
+	funlockfile(stdout);
+}
+
+
+/*****************************************************************************
+*** Function:    void show_rate(void)                                      ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show frames, wakeups and receive buffer drops of the last second. If   ***
+*** there is more than one interface, a line per interface follows. In     ***
+*** stats mode, the screen is cleared and the per-ID tables are drawn      ***
+*** below. Called once per second from the receive loop or, in thread      ***
+*** mode, from the main thread.                                            ***
+*****************************************************************************/
+static void show_rate(void)
+{
+	unsigned long long frames = 0, bytes = 0, wakeups, if_rx;
+	unsigned long long drops = any_drops - last_any_drops;
+	struct can_if *cif;
+	int i;
+
+	if (stats_mode)
+		fprintf(stderr, "\033[H\033[2J");
+	wakeups = rx_stats.wakeups - rx_stats.last_wakeups;
+	rx_stats.last_wakeups = rx_stats.wakeups;
+	for (i = 0; i < nifs; i++) {
+		cif = &ifs[i];
+		ring_drops(cif);
+		wakeups += cif->stats.wakeups - cif->stats.last_wakeups;
+		cif->stats.last_wakeups = cif->stats.wakeups;
+		frames += cif->frames - cif->last_frames;
+		bytes += cif->bytes - cif->last_bytes;
+		drops += cif->drops - cif->last_drops;
+	}
+	last_any_drops = any_drops;
+
+	fprintf(stderr, "rx: %llu frames/s, %llu bytes/s, %llu wakeups/s, "
+		"%.2f frames/wakeup, %llu drops/s", frames, bytes, wakeups,
+		wakeups ? (double)frames / wakeups : 0.0, drops);
+	if (seq_mode) {
+		struct id_entry sum;
+
+		memset(&sum, 0, sizeof(sum));
+		for (i = 0; i < nifs; i++)
+			sum_ids(ifs[i].ids, &sum);
+		fprintf(stderr, ", lost %llu, dup %llu, reorder %llu, "
+			"corrupt %llu, resync %llu", sum.lost, sum.dup,
+			sum.reorder, sum.corrupt, sum.resync);
+	}
+	if ((nifs == 1) && !read_if_counter(ifs[0].name, &if_rx)) {
+		fprintf(stderr, ", interface %llu frames/s",
+			if_rx - ifs[0].if_last);
+		ifs[0].if_last = if_rx;
+	}
+	fprintf(stderr, "\n");
+
+	for (i = 0; i < nifs; i++) {
+		cif = &ifs[i];
+		if (nifs > 1) {
+			fprintf(stderr, "  %-8s %llu frames/s, %llu bytes/s",
+				cif->name, cif->frames - cif->last_frames,
+				cif->bytes - cif->last_bytes);
+			if (cif->fd >= 0)
+				fprintf(stderr, ", %llu drops/s",
+					cif->drops - cif->last_drops);
+			if (!read_if_counter(cif->name, &if_rx)) {
+				fprintf(stderr, ", interface %llu frames/s",
+					if_rx - cif->if_last);
+				cif->if_last = if_rx;
+			}
+			fprintf(stderr, "\n");
+		}
+		cif->last_frames = cif->frames;
+		cif->last_bytes = cif->bytes;
+		cif->last_drops = cif->drops;
+	}
+	if (stats_mode)
+		for (i = 0; i < nifs; i++)
+			show_stats(&ifs[i]);
+}
+
+
+/*****************************************************************************
+*** Function:    void show_summary(struct rusage *start)                   ***
+***                                                                        ***
+*** Parameters:  start: resource usage at the start of the receive loop    ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Show total frames, the distribution of frames per wakeup and the CPU   ***
+*** time that was needed per frame. The frames received by each interface  ***
+*** are shown, too, to see how many frames the filters have saved and how  ***
+*** many the kernel has dropped because the receive buffer was full.       ***
+*****************************************************************************/
+static void show_summary(struct rusage *start)
+{
+	unsigned long long frames = 0, bytes = 0, wakeups, hist, if_rx;
+	struct can_if *cif;
+	struct rusage end;
+	double user, sys;
+	unsigned int i;
+	int k;
+
+	getrusage(RUSAGE_SELF, &end);
+	user = (end.ru_utime.tv_sec - start->ru_utime.tv_sec)
+		+ (end.ru_utime.tv_usec - start->ru_utime.tv_usec) / 1e6;
+	sys = (end.ru_stime.tv_sec - start->ru_stime.tv_sec)
+		+ (end.ru_stime.tv_usec - start->ru_stime.tv_usec) / 1e6;
+
+	wakeups = rx_stats.wakeups;
+	for (k = 0; k < nifs; k++) {
+		ring_drops(&ifs[k]);
+		frames += ifs[k].frames;
+		bytes += ifs[k].bytes;
+		wakeups += ifs[k].stats.wakeups;
+	}
+	fprintf(stderr, "\n%llu frames (%llu payload bytes) in %llu wakeups "
+		"(%.2f frames/wakeup)\n", frames, bytes, wakeups,
+		wakeups ? (double)frames / wakeups : 0.0);
+	for (k = 0; k < nifs; k++) {
+		cif = &ifs[k];
+		fprintf(stderr, "%s: %llu frames", cif->name, cif->frames);
+		if (!read_if_counter(cif->name, &if_rx)) {
+			if_rx -= cif->if_start;
+			fprintf(stderr, ", %llu on interface, %llu (%.1f%%) "
+				"dropped by filters", if_rx,
+				(if_rx > cif->frames) ? if_rx - cif->frames : 0,
+				(if_rx > cif->frames) ?
+				100.0 * (if_rx - cif->frames) / if_rx : 0.0);
+		}
+		if (cif->fd >= 0)
+			fprintf(stderr, ", %llu dropped by a full receive "
+				"buffer", cif->drops);
+		fprintf(stderr, "\n");
+	}
+	if (any_fd >= 0)
+		fprintf(stderr, "any: %llu dropped by a full receive buffer\n",
+			any_drops);
+	if (unknown_if)
+		fprintf(stderr, "%llu frames from too many interfaces\n",
+			unknown_if);
+	fprintf(stderr, "frames/wakeup  wakeups\n");
+	for (i = 0; i <= batch; i++) {
+		hist = rx_stats.batch_hist[i];
+		for (k = 0; k < nifs; k++)
+			hist += ifs[k].stats.batch_hist[i];
+		if (hist)
+			fprintf(stderr, "%13u  %llu\n", i, hist);
+	}
+	fprintf(stderr, "cpu: %.3fs user, %.3fs sys", user, sys);
+	if (frames)
+		fprintf(stderr, ", %.2fus/frame", (user + sys) * 1e6 / frames);
+	fprintf(stderr, " (%s)", ring_mode ? "packet ring" : "raw socket");
+	fprintf(stderr, "\n");
+	if (seq_mode) {
+		for (k = 0; k < nifs; k++) {
+			if (nifs > 1)
+				fprintf(stderr, "\n%s:\n", ifs[k].name);
+			show_ids(ifs[k].ids);
+		}
+	}
+	if (stats_mode) {
+		fprintf(stderr, "\n");
+		for (k = 0; k < nifs; k++)
+			show_stats(&ifs[k]);
+	}
+	if (lat_mode) {
+		for (k = 0; k < nifs; k++) {
+			fprintf(stderr, "\n%s%s:\n", ifs[k].name,
+				hw_stamps ? "" : " (software time stamps)");
+			hist_show("inter-arrival", &ifs[k].lat->arrival);
+			hist_show("delivery", &ifs[k].lat->delivery);
+		}
+	}
+}
+
+
+/*****************************************************************************
+*** Function:    unsigned int ring_walk(struct can_if *cif)                ***
+***                                                                        ***
+*** Parameters:  cif: interface with a packet ring                         ***
+***                                                                        ***
+*** Return:      Number of frames handled                                  ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Hand all frames of the blocks the kernel has passed to user space to   ***
+*** handle_frame(), straight out of the ring, and give the blocks back.    ***
+*** Like the raw socket, classic mode ignores CAN FD frames. The packet    ***
+*** socket also gets a copy of each frame sent on the interface            ***
+*** (PACKET_OUTGOING); the raw socket never sees them, so they are skipped ***
+*** to keep the comparison fair.                                           ***
+*****************************************************************************/
+static unsigned int ring_walk(struct can_if *cif)
+{
+	struct can_ring *r = cif->ring;
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *sll;
+	struct rx_meta meta;
+	unsigned int n, i, frames = 0;
+	uint64_t ts;
+
+	for (;;) {
+		bd = (struct tpacket_block_desc *)(r->map
+			+ (size_t)r->next * r->block_size);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		meta.now = realtime_ns();
+		meta.drops = 0;
+		n = bd->hdr.bh1.num_pkts;
+		hdr = (struct tpacket3_hdr *)((uint8_t *)bd
+			+ bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < n; i++) {
+			sll = (struct sockaddr_ll *)((uint8_t *)hdr
+				+ TPACKET_ALIGN(sizeof(*hdr)));
+			if (sll->sll_pkttype == PACKET_OUTGOING) {
+				hdr = (struct tpacket3_hdr *)((uint8_t *)hdr
+					+ hdr->tp_next_offset);
+				continue;
+			}
+			frames++;
+			ts = (uint64_t)hdr->tp_sec * 1000000000ULL
+				+ hdr->tp_nsec;
+			meta.sw = meta.hw = 0;
+			if (hdr->tp_status & TP_STATUS_TS_RAW_HARDWARE)
+				meta.hw = ts;
+			else
+				meta.sw = ts;
+			if (fd_mode || (hdr->tp_snaplen == CAN_MTU))
+				handle_frame(cif, (struct canfd_frame *)
+					     ((uint8_t *)hdr + hdr->tp_mac),
+					     hdr->tp_snaplen, &meta);
+			hdr = (struct tpacket3_hdr *)((uint8_t *)hdr
+				+ hdr->tp_next_offset);
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		r->next = (r->next + 1) % r->nblocks;
+	}
+
+	return frames;
+}
+
+
+/*****************************************************************************
+*** Function:    void rx_loop(struct rx_stats *st, struct can_if *only)    ***
+***                                                                        ***
+*** Parameters:  st:   statistics of this loop                             ***
+***              only: serve only this interface (thread mode); NULL to    ***
+***                    serve all sockets and show the rate once per second ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** The receive loop sleeps in epoll_wait() until frames are available and ***
+*** then fetches up to <batch> frames with one recvmmsg() call. The source ***
+*** address of each message tells the interface the frame came from, the   ***
+*** ancillary data carries the kernel and hardware time stamps. A          ***
+*** timerfd in the same epoll set shows the rate once per second. In       ***
+*** thread mode, epoll_wait() times out once per second, so the thread     ***
+*** sees the end of the program even if it misses the signal.              ***
+*** With -M, a ready socket means that blocks of its packet ring are       ***
+*** ready, and the frames are read from the ring instead.                  ***
+*****************************************************************************/
+static void rx_loop(struct rx_stats *st, struct can_if *only)
+{
+	struct canfd_frame frames[MAX_BATCH];
+	struct sockaddr_can addrs[MAX_BATCH];
+	char cmsgs[MAX_BATCH][RX_CMSG_SIZE];
+	struct rx_meta meta;
+	struct cmsghdr *cmsg;
+	struct iovec iov[MAX_BATCH];
+	struct mmsghdr msgs[MAX_BATCH];
+	struct epoll_event ev, events[MAX_IFS + 1];
+	struct itimerspec tick = {{1, 0}, {1, 0}};
+	struct can_if *cif;
+	uint64_t expired;
+	int epfd, tfd = -1;
+	int n, nev, i, k, fd;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < MAX_BATCH; i++) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = CANFD_MTU;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_control = cmsgs[i];
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("failed to create epoll");
+		return;
+	}
+	ev.events = EPOLLIN;
+	if (only) {
+		ev.data.fd = only->fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, only->fd, &ev);
+	} else {
+		if (any_fd >= 0) {
+			ev.data.fd = any_fd;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, any_fd, &ev);
+		}
+		for (i = 0; i < nifs; i++) {
+			ev.data.fd = ifs[i].fd;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, ifs[i].fd, &ev);
+		}
+		tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (tfd < 0) {
+			perror("failed to create timer");
+			close(epfd);
+			return;
+		}
+		timerfd_settime(tfd, 0, &tick, NULL);
+		ev.data.fd = tfd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	}
+
+	while (running) {
+		nev = epoll_wait(epfd, events, MAX_IFS + 1, only ? 1000 : -1);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+		for (k = 0; k < nev; k++) {
+			fd = events[k].data.fd;
+			if (fd == tfd) {
+				if (read(tfd, &expired, sizeof(expired)) > 0)
+					show_rate();
+				continue;
+			}
+			if (ring_mode) {
+				for (i = 0; i < nifs; i++)
+					if (ifs[i].fd == fd)
+						ring_walk(&ifs[i]);
+				st->wakeups++;
+				continue;
+			}
+
+			for (i = 0; i < (int)batch; i++) {
+				msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+				msgs[i].msg_hdr.msg_controllen = RX_CMSG_SIZE;
+			}
+			n = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, NULL);
+			if (n < 0) {
+				if ((errno != EAGAIN) && (errno != EINTR))
+					perror("recvmmsg");
+				continue;
+			}
+			meta.now = realtime_ns();
+			st->wakeups++;
+			st->batch_hist[n]++;
+
+			for (i = 0; i < n; i++) {
+				cif = only ? only : find_if(addrs[i].can_ifindex);
+				if (!cif) {
+					unknown_if++;
+					continue;
+				}
+				meta.sw = meta.hw = 0;
+				meta.drops = 0;
+				for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+				     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+					parse_cmsg(cmsg, &meta);
+				/* Only sent once drops have happened */
+				if (meta.drops) {
+					if (fd == any_fd)
+						any_drops = meta.drops;
+					else
+						cif->drops = meta.drops;
+				}
+				handle_frame(cif, &frames[i], msgs[i].msg_len,
+					     &meta);
+			}
+		}
+	}
+
+	if (tfd >= 0)
+		close(tfd);
+	close(epfd);
+}
+
+
+/*****************************************************************************
+*** Function:    void *rx_thread(void *arg)                                ***
+***                                                                        ***
+*** Parameters:  arg: interface served by this thread                      ***
+***                                                                        ***
+*** Return:      NULL                                                      ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Receive thread of one interface. The thread is pinned to a CPU, the    ***
+*** interfaces are distributed round robin over all online CPUs.           ***
+*****************************************************************************/
+static void *rx_thread(void *arg)
+{
+	struct can_if *cif = arg;
+	cpu_set_t cpus;
+	long ncpus;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET((cif - ifs) % ncpus, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	rx_loop(&cif->stats, cif);
+
+	return NULL;
+}
+
+
+/*****************************************************************************
+*** Function:    void read_port(void)                                      ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** This function reads out the CAN Frames of all opened interfaces and    ***
+*** print them out until the program is stopped with strg-c. All sockets   ***
+*** are served by one epoll loop or, in thread mode, by one pinned thread  ***
+*** per interface while the main thread shows the rates.                   ***
+*****************************************************************************/
+void read_port(void)
+{
+	struct rusage start;
+	uint64_t next;
+	int i;
+
+	catch_signals();
+	getrusage(RUSAGE_SELF, &start);
+	if (!quiet && !seq_mode && !stats_mode && !lat_mode && !cap)
+		printf("(time) \t ID \t [DLC] \t data\n");
+
+	if (!threads) {
+		rx_loop(&rx_stats, NULL);
+	} else {
+		for (i = 0; i < nifs; i++) {
+			if (pthread_create(&ifs[i].thread, NULL, rx_thread,
+					   &ifs[i])) {
+				perror("failed to create thread");
+				running = 0;
+				nifs = i;
+				break;
+			}
+		}
+		next = now_ns();
+		while (running) {
+			next += 1000000000ULL;
+			sleep_until(next);
+			if (running)
+				show_rate();
+		}
+		for (i = 0; i < nifs; i++) {
+			pthread_kill(ifs[i].thread, SIGINT);
+			pthread_join(ifs[i].thread, NULL);
+		}
+	}
+
+	show_summary(&start);
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_jobs(char *arg)                                 ***
+***                                                                        ***
+*** Parameters:  arg: comma separated list of id:period[:data]             ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Parse the jobs of the cyclic mode. ID and data are hex, the period is  ***
+*** in milliseconds and may have a fraction (e.g. 0.5). For the broadcast  ***
+*** manager, which takes a struct timeval, it is rounded to whole          ***
+*** microseconds. The data is given as hex string without spaces, up to 8  ***
+*** bytes (64 bytes in FD mode).                                           ***
+*** Each job also gets a receive filter, so the measuring socket only sees ***
+*** the cyclic frames; therefore -f can not be used together with jobs.    ***
+*****************************************************************************/
+static int parse_jobs(char *arg)
+{
+	struct cyc_job *job;
+	char *tok, *end;
+	unsigned int max = fd_mode ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+	unsigned long id;
+	double period;
+
+	if (nfilters) {
+		fprintf(stderr, "-f can not be used with cyclic jobs, they set "
+			"their own filters\n");
+		return 1;
+	}
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (njobs >= MAX_JOBS) {
+			fprintf(stderr, "too many jobs (max. %d)\n", MAX_JOBS);
+			return 1;
+		}
+		job = &jobs[njobs++];
+		id = strtoul(tok, &end, 16);
+		if ((end == tok) || (*end != ':') || (id > CAN_EFF_MASK))
+			return 1;
+		job->frame.can_id = id;
+		if (job->frame.can_id > CAN_SFF_MASK)
+			job->frame.can_id |= CAN_EFF_FLAG;
+		period = strtod(end + 1, &end);
+		/* NaN passes a plain <= 0 check, and a period that ends up
+		   as 0 below would arm a zero interval */
+		if (!isfinite(period) || (period <= 0)
+		    || (period * 1000000 >= (double)UINT64_MAX))
+			return 1;
+		job->period = period * 1000000;
+		if (!user_loop && (job->period % 1000)) {
+			/* The broadcast manager takes a struct timeval */
+			job->period = (job->period + 500) / 1000 * 1000;
+			if (job->period)
+				fprintf(stderr, "period %gms rounded to %lluus "
+					"for the broadcast manager\n", period,
+					(unsigned long long)job->period / 1000);
+		}
+		if (!job->period) {
+			fprintf(stderr, "period %gms is too short%s\n", period,
+				user_loop ? "" : " for the broadcast manager "
+				"(min. 0.001ms)");
+			return 1;
+		}
+		if (*end == ':') {
+			end++;
+			while (isxdigit(end[0]) && isxdigit(end[1])
+			       && (job->frame.len < max)) {
+				sscanf(end, "%2hhx",
+				       &job->frame.data[job->frame.len++]);
+				end += 2;
+			}
+		}
+		if (*end)
+			return 1;
+		if (fd_mode) {
+			job->frame.len = fd_round_len(job->frame.len);
+			job->frame.flags = CANFD_BRS;
+		}
+
+		filters[job - jobs].can_id = job->frame.can_id;
+		filters[job - jobs].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG
+			| ((job->frame.can_id & CAN_EFF_FLAG) ?
+			   CAN_EFF_MASK : CAN_SFF_MASK);
+	}
+	nfilters = njobs;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int bcm_setup(const char *can_port)                       ***
+***                                                                        ***
+*** Parameters:  can_port: name of the can device                          ***
+***                                                                        ***
+*** Return:      Broadcast manager socket; -1: Failure                     ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Open a CAN_BCM socket and register a TX_SETUP job for each cyclic      ***
+*** frame. From then on, the kernel sends the frames with its own timer;   ***
+*** the jobs are deleted when the socket is closed.                        ***
+*****************************************************************************/
+static int bcm_setup(const char *can_port)
+{
+	struct {
+		struct bcm_msg_head head;
+		struct canfd_frame frame;
+	} msg;
+	struct sockaddr_can addr;
+	size_t size;
+	int fd, i;
+
+	fd = socket(PF_CAN, SOCK_DGRAM, CAN_BCM);
+	if (fd < 0) {
+		perror("failed to open bcm socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(can_port);
+	if (!addr.can_ifindex
+	    || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+		perror("failed to connect bcm socket");
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < njobs; i++) {
+		memset(&msg, 0, sizeof(msg));
+		msg.head.opcode = TX_SETUP;
+		msg.head.flags = SETTIMER | STARTTIMER;
+		msg.head.can_id = jobs[i].frame.can_id;
+		msg.head.nframes = 1;
+		msg.head.ival2.tv_sec = jobs[i].period / 1000000000ULL;
+		msg.head.ival2.tv_usec = jobs[i].period % 1000000000ULL / 1000;
+		msg.frame = jobs[i].frame;
+		size = sizeof(msg.head) + sizeof(struct can_frame);
+		if (fd_mode) {
+			msg.head.flags |= CAN_FD_FRAME;
+			size = sizeof(msg.head) + sizeof(struct canfd_frame);
+		}
+		if (write(fd, &msg, size) != (ssize_t)size) {
+			perror("failed to set up bcm job");
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+
+/*****************************************************************************
+*** Function:    int cyclic_port(const char *can_port, char *job_list)     ***
+***                                                                        ***
+*** Parameters:  can_port: name of the can device                          ***
+***              job_list: comma separated list of id:period[:data]        ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Send periodic frames until strg-c. By default, the jobs are handed to  ***
+*** the broadcast manager in the kernel and the process just sleeps. With  ***
+*** -u, the frames are sent by a user space loop that sleeps between the   ***
+*** frames, like the write mode does, for comparison.                      ***
+*** The sent frames are received again on a raw socket in a separate       ***
+*** thread; the deviation of each measured period from the job period is   ***
+*** collected per job. At the end, the jitter and the CPU time of the      ***
+*** sending thread are shown.                                              ***
+*****************************************************************************/
+int cyclic_port(const char *can_port, char *job_list)
+{
+	struct can_if *cif;
+	struct rusage start, end;
+	uint64_t now, next, report;
+	int bcm = -1, fd, i;
+	int mtu = fd_mode ? CANFD_MTU : CAN_MTU;
+
+	if (parse_jobs(job_list) || !njobs) {
+		fprintf(stderr, "bad job list\n");
+		return 1;
+	}
+
+	/* Measuring socket with receive time stamps */
+	fd = open_socket(can_port);
+	if (fd < 0)
+		return 1;
+	cif = add_if(can_port, if_nametoindex(can_port), fd);
+	if (!cif)
+		return 1;
+	catch_signals();
+	if (pthread_create(&cif->thread, NULL, rx_thread, cif)) {
+		perror("failed to create thread");
+		return 1;
+	}
+
+	getrusage(RUSAGE_THREAD, &start);
+	now = now_ns();
+	report = now + 1000000000ULL;
+	if (!user_loop) {
+		bcm = bcm_setup(can_port);
+		if (bcm < 0)
+			running = 0;
+	} else {
+		for (i = 0; i < njobs; i++)
+			jobs[i].next = now;
+	}
+
+	while (running) {
+		if (!user_loop) {
+			/* The kernel sends, only show the jitter */
+			sleep_until(report);
+		} else {
+			next = report;
+			for (i = 0; i < njobs; i++) {
+				if (jobs[i].next <= now) {
+					if (write(soc, &jobs[i].frame, mtu) != mtu)
+						perror("failed to write can frame");
+					jobs[i].next += jobs[i].period;
+				}
+				if (jobs[i].next < next)
+					next = jobs[i].next;
+			}
+			now = now_ns();
+			if (next > now)
+				usleep((next - now) / 1000);
+		}
+
+		now = now_ns();
+		if (now >= report) {
+			for (i = 0; i < njobs; i++)
+				fprintf(stderr, "%03X: %llu frames, jitter p99 "
+					"%.1fus max %.1fus\n",
+					jobs[i].frame.can_id & CAN_EFF_MASK,
+					jobs[i].frames, jobs[i].jitter.count ?
+					hist_quantile(&jobs[i].jitter, 0.99)
+					/ 1e3 : 0.0, jobs[i].jitter.max / 1e3);
+			report += 1000000000ULL;
+		}
+	}
+	getrusage(RUSAGE_THREAD, &end);
+
+	if (bcm >= 0)
+		close(bcm);
+	pthread_kill(cif->thread, SIGINT);
+	pthread_join(cif->thread, NULL);
+
+	fprintf(stderr, "\n%s: sender cpu %.3fs user, %.3fs sys\n",
+		user_loop ? "user space loop" : "broadcast manager",
+		(end.ru_utime.tv_sec - start.ru_utime.tv_sec)
+		+ (end.ru_utime.tv_usec - start.ru_utime.tv_usec) / 1e6,
+		(end.ru_stime.tv_sec - start.ru_stime.tv_sec)
+		+ (end.ru_stime.tv_usec - start.ru_stime.tv_usec) / 1e6);
+	for (i = 0; i < njobs; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "%03X jitter",
+			 jobs[i].frame.can_id & CAN_EFF_MASK);
+		hist_show(name, &jobs[i].jitter);
+	}
+
+	return (bcm < 0) && !user_loop;
+}
+
+
+/*****************************************************************************
+*** Function:    int set_realtime(void)                                    ***
+***                                                                        ***
+*** Parameters:  -                                                         ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Switch to SCHED_FIFO with the priority of -p and pin the process to    ***
+*** the CPU of -c. Memory is locked, so page faults do not show up in the  ***
+*** measured times.                                                        ***
+*****************************************************************************/
+static int set_realtime(void)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+
+	if (rt_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rt_cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			perror("failed to pin to cpu");
+			return 1;
+		}
+	}
+	if (rt_prio) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			perror("failed to set SCHED_FIFO");
+			return 1;
+		}
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+			perror("failed to lock memory");
+	}
+
+	return 0;
+}
 
 
 /*****************************************************************************
-*** Function:    int open_port(const char *port)                           ***
+*** Function:    int set_rx_filter(canid_t id, int timeout_ms)             ***
 ***                                                                        ***
-*** Parameters:  port: name of the can device                              ***
+*** Parameters:  id:         only ID to receive                            ***
+***              timeout_ms: receive timeout, 0: wait forever              ***
 ***                                                                        ***
 *** Return:      0: Success; 1: Failure                                    ***
 ***                                                                        ***
 *** Description                                                            ***
 *** -----------                                                            ***
-*** This function open and initailize a can socket.                        ***
+*** Let the kernel pass only one ID to the global socket.                  ***
 *****************************************************************************/
-int open_port(const char *port)
+static int set_rx_filter(canid_t id, int timeout_ms)
 {
-	struct ifreq ifr;
-	struct sockaddr_can addr;
+	struct can_filter filter;
+	struct timeval tv;
 
-	/* open socket */
-	soc = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-	if(soc < 0) {
-		fprintf(stderr, "failed to open socket\n");
+	filter.can_id = id;
+	filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG
+		| ((id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+	if (setsockopt(soc, SOL_CAN_RAW, CAN_RAW_FILTER, &filter,
+		       sizeof(filter)) < 0) {
+		perror("failed to set can filter");
+		return 1;
+	}
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	if (setsockopt(soc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		perror("failed to set receive timeout");
 		return 1;
 	}
 
-	addr.can_family = AF_CAN;
-	strcpy(ifr.ifr_name, port);
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int parse_ping_id(const char *arg, canid_t *id)           ***
+***                                                                        ***
+*** Parameters:  arg: hex ID or NULL for the default                       ***
+***              id:  receives the ID with CAN_EFF_FLAG for extended IDs   ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** The ping goes out on this ID, the pong comes back on ID + 1. So the    ***
+*** last ID of each format can not be used, its pong ID would not fit.     ***
+*****************************************************************************/
+static int parse_ping_id(const char *arg, canid_t *id)
+{
+	char *end;
+
+	*id = DEFAULT_PING_ID;
+	if (arg) {
+		*id = strtoul(arg, &end, 16);
+		if ((end == arg) || *end || (*id >= CAN_EFF_MASK)
+		    || (*id == CAN_SFF_MASK)) {
+			fprintf(stderr, "bad ping ID '%s'\n", arg);
+			return 1;
+		}
+	}
+	if (*id > CAN_SFF_MASK)
+		*id |= CAN_EFF_FLAG;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int ping_port(const char *arg)                            ***
+***                                                                        ***
+*** Parameters:  arg: ping ID (hex) or NULL                                ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Send numbered frames on the ping ID and wait for the echo of the pong  ***
+*** process on ID + 1. The round trip time from before write() to after    ***
+*** read() goes into a histogram. Echoes that do not come within           ***
+*** PING_TIMEOUT ms count as lost, late echoes of older pings are skipped. ***
+*** -n sets the number of pings, -r the pings per second (default back to  ***
+*** back).                                                                 ***
+*****************************************************************************/
+int ping_port(const char *arg)
+{
+	struct canfd_frame frame, reply;
+	struct hist *rtt;
+	canid_t id;
+	unsigned long long pings = count ? count : DEFAULT_PINGS;
+	unsigned long long seq, lost = 0;
+	uint64_t start, end, next = 0;
+	int mtu = fd_mode ? CANFD_MTU : CAN_MTU;
+	ssize_t len;
 
-	if(ioctl(soc, SIOCGIFINDEX, &ifr) < 0) {
-		fprintf(stderr, "failed to initialize socket\n");
+	if (parse_ping_id(arg, &id))
+		return 1;
+	rtt = calloc(1, sizeof(*rtt));
+	if (!rtt) {
+		perror("failed to allocate histogram");
+		return 1;
+	}
+	if (set_rx_filter((id + 1) & ~CAN_ERR_FLAG, PING_TIMEOUT)
+	    || set_realtime()) {
+		free(rtt);
 		return 1;
 	}
+	catch_signals();
+
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = id;
+	frame.len = fd_mode ? fd_len : CAN_MAX_DLEN;
+	if (fd_mode)
+		frame.flags = CANFD_BRS;
+	if (frame.len < 4)
+		frame.len = 4;
 
-	addr.can_ifindex = ifr.ifr_ifindex;
+	for (seq = 0; running && (seq < pings); seq++) {
+		if (rate) {
+			if (!next)
+				next = now_ns();
+			sleep_until(next);
+			next += 1000000000ULL / rate;
+		}
+		frame.data[0] = seq;
+		frame.data[1] = seq >> 8;
+		frame.data[2] = seq >> 16;
+		frame.data[3] = seq >> 24;
 
-	fcntl(soc, F_SETFL, O_NONBLOCK);
+		start = now_ns();
+		if (write(soc, &frame, mtu) != mtu) {
+			perror("failed to write can frame");
+			break;
+		}
+		do {
+			len = read(soc, &reply, sizeof(reply));
+		} while ((len >= 4 + (ssize_t)offsetof(struct canfd_frame, data))
+			 && memcmp(reply.data, frame.data, 4));
+		end = now_ns();
 
-	if(bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		fprintf(stderr, "failed to bind socket\n");
+		if (len < 0) {
+			if (errno != EAGAIN)
+				break;
+			lost++;
+			continue;
+		}
+		hist_add(rtt, end - start);
+	}
+
+	fprintf(stderr, "%llu pings to %03X, %llu lost\n", seq,
+		id & CAN_EFF_MASK, lost);
+	hist_show("round trip", rtt);
+	free(rtt);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    int pong_port(const char *arg)                            ***
+***                                                                        ***
+*** Parameters:  arg: ping ID (hex) or NULL                                ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Echo every frame of the ping ID on ID + 1 at once, until strg-c.       ***
+*****************************************************************************/
+int pong_port(const char *arg)
+{
+	struct canfd_frame frame;
+	canid_t id;
+	unsigned long long pongs = 0;
+	ssize_t len;
+
+	if (parse_ping_id(arg, &id) || set_rx_filter(id, 0) || set_realtime())
 		return 1;
+	catch_signals();
+
+	while (running) {
+		len = read(soc, &frame, sizeof(frame));
+		if (len < 0) {
+			if (errno != EINTR)
+				perror("failed to read can frame");
+			break;
+		}
+		frame.can_id = (frame.can_id + 1) & ~CAN_ERR_FLAG;
+		if (write(soc, &frame, len) != len) {
+			perror("failed to write can frame");
+			break;
+		}
+		pongs++;
 	}
+	fprintf(stderr, "%llu pongs on %03X\n", pongs,
+		(id + 1) & CAN_EFF_MASK);
 
 	return 0;
 }
 
 
 /*****************************************************************************
-*** Function:    int send_port(int send_start)                             ***
+*** Function:    int parse_rewrites(char *arg)                             ***
 ***                                                                        ***
-*** Parameters:  send_start: flag to check how much frames to send (1 or   ***
-***              endless loop)                                             ***
+*** Parameters:  arg: comma separated list of from=to (hex IDs)            ***
 ***                                                                        ***
 *** Return:      0: Success; 1: Failure                                    ***
 ***                                                                        ***
 *** Description                                                            ***
 *** -----------                                                            ***
-*** This function sends one or more can frames to the bus.                 ***
+*** Parse the ID rewrite rules of the bridge mode. IDs above 0x7FF are     ***
+*** extended IDs.                                                          ***
 *****************************************************************************/
-int send_port(int send_start)
+static int parse_rewrites(char *arg)
 {
-	struct can_frame frame;
-	int retval, i;
+	char *tok, *end;
+	canid_t id[2];
+	int i;
 
-	srand(time(NULL));
-	while(1) {
-		frame.can_id = rand() % 1000;
-		frame.can_dlc = rand() % 8;
-		for(i = 0; i <= frame.can_dlc; i++) {
-			frame.data[i] = rand() % 255;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nrewrites >= MAX_FILTERS) {
+			fprintf(stderr, "too many rewrite rules (max. %d)\n",
+				MAX_FILTERS);
+			return 1;
 		}
-		retval = write(soc, &frame, sizeof(struct can_frame));
-		if (retval != sizeof(struct can_frame)) {
-			fprintf(stderr, "failed to write can frame\n");
+		id[0] = strtoul(tok, &end, 16);
+		if (*end != '=')
 			return 1;
+		id[1] = strtoul(end + 1, &end, 16);
+		if (*end)
+			return 1;
+		for (i = 0; i < 2; i++)
+			if (id[i] > CAN_SFF_MASK)
+				id[i] = (id[i] & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		rewrites[nrewrites].from = id[0];
+		rewrites[nrewrites].to = id[1];
+		nrewrites++;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*** Function:    void bridge_forward(struct bridge_dir *dir)               ***
+***                                                                        ***
+*** Parameters:  dir: direction with frames ready to read                  ***
+***                                                                        ***
+*** Return:      -                                                         ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Fetch up to <batch> frames with recvmmsg(), rewrite their IDs and send ***
+*** them on with one sendmmsg() call. A bridge must not fall behind, so    ***
+*** frames that do not fit into the transmit queue are dropped and         ***
+*** counted instead of waiting. The forwarding latency is the time from    ***
+*** the kernel receive time stamp to the return of sendmmsg().             ***
+*****************************************************************************/
+static void bridge_forward(struct bridge_dir *dir)
+{
+	struct canfd_frame frames[MAX_BATCH];
+	char cmsgs[MAX_BATCH][RX_CMSG_SIZE];
+	struct iovec iov[MAX_BATCH];
+	struct mmsghdr rx[MAX_BATCH], tx[MAX_BATCH];
+	struct rx_meta meta[MAX_BATCH];
+	struct cmsghdr *cmsg;
+	canid_t id;
+	uint64_t now;
+	int n, i, k, sent = 0;
+
+	memset(rx, 0, sizeof(rx));
+	memset(tx, 0, sizeof(tx));
+	for (i = 0; i < (int)batch; i++) {
+		iov[i].iov_base = &frames[i];
+		iov[i].iov_len = CANFD_MTU;
+		rx[i].msg_hdr.msg_iov = &iov[i];
+		rx[i].msg_hdr.msg_iovlen = 1;
+		rx[i].msg_hdr.msg_control = cmsgs[i];
+		rx[i].msg_hdr.msg_controllen = RX_CMSG_SIZE;
+		tx[i].msg_hdr.msg_iov = &iov[i];
+		tx[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = recvmmsg(dir->in, rx, batch, MSG_DONTWAIT, NULL);
+	if (n <= 0) {
+		if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+			perror("recvmmsg");
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_len = rx[i].msg_len;
+		memset(&meta[i], 0, sizeof(meta[i]));
+		for (cmsg = CMSG_FIRSTHDR(&rx[i].msg_hdr); cmsg;
+		     cmsg = CMSG_NXTHDR(&rx[i].msg_hdr, cmsg))
+			parse_cmsg(cmsg, &meta[i]);
+
+		id = frames[i].can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+		for (k = 0; k < nrewrites; k++) {
+			if (rewrites[k].from == id) {
+				frames[i].can_id = rewrites[k].to
+					| (frames[i].can_id & CAN_RTR_FLAG);
+				dir->rewritten++;
+				break;
+			}
 		}
-		if(send_start == 0)
+	}
+
+	while (sent < n) {
+		k = sendmmsg(dir->out, &tx[sent], n - sent, MSG_DONTWAIT);
+		if (k > 0) {
+			sent += k;
+			continue;
+		}
+		if ((errno != ENOBUFS) && (errno != EAGAIN) && (errno != EINTR))
+			perror("failed to forward can frames");
+		break;
+	}
+	now = realtime_ns();
+
+	dir->frames += sent;
+	dir->drops += n - sent;
+	for (i = 0; i < sent; i++)
+		if (meta[i].sw && (now > meta[i].sw))
+			hist_add(&dir->lat, now - meta[i].sw);
+}
+
+
+/*****************************************************************************
+*** Function:    int bridge_port(const char *port, const char *peer,       ***
+***                            char *rules)                                ***
+***                                                                        ***
+*** Parameters:  port:  name of the port of open_port()                    ***
+***              peer:  name of the second can device                      ***
+***              rules: comma separated rewrite rules from=to or NULL      ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Forward frames between the port of open_port() and a second port in    ***
+*** both directions until strg-c. The receive filters of -f are installed  ***
+*** on both sockets. CAN_RAW_RECV_OWN_MSGS stays off, so the frames the    ***
+*** bridge sends are not received again by the same socket and can not     ***
+*** loop. Forwarded frames and drops are shown once per second, the        ***
+*** forwarding latency of each direction at the end.                       ***
+*****************************************************************************/
+int bridge_port(const char *port, const char *peer, char *rules)
+{
+	struct bridge_dir *dirs;
+	struct epoll_event ev, events[3];
+	struct itimerspec tick = {{1, 0}, {1, 0}};
+	uint64_t expired;
+	int fd, epfd, tfd, nev, i, k, off = 0, ret = 1;
+
+	if (rules && parse_rewrites(rules)) {
+		fprintf(stderr, "bad rewrite rules\n");
+		return 1;
+	}
+	fd = open_socket(peer);
+	if (fd < 0)
+		return 1;
+	dirs = calloc(2, sizeof(*dirs));
+	if (!dirs) {
+		perror("failed to allocate bridge");
+		close(fd);
+		return 1;
+	}
+	dirs[0].in = dirs[1].out = soc;
+	dirs[0].out = dirs[1].in = fd;
+	snprintf(dirs[0].name, sizeof(dirs[0].name), "%s -> %s", port, peer);
+	snprintf(dirs[1].name, sizeof(dirs[1].name), "%s -> %s", peer, port);
+	for (i = 0; i < 2; i++) {
+		if (setsockopt(dirs[i].in, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS,
+			       &off, sizeof(off)) < 0) {
+			perror("failed to disable own messages");
+			goto out;
+		}
+	}
+
+	epfd = epoll_create1(0);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if ((epfd < 0) || (tfd < 0)) {
+		perror("failed to create epoll or timer");
+		if (epfd >= 0)
+			close(epfd);
+		if (tfd >= 0)
+			close(tfd);
+		goto out;
+	}
+	timerfd_settime(tfd, 0, &tick, NULL);
+	ev.events = EPOLLIN;
+	for (i = 0; i < 2; i++) {
+		ev.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, dirs[i].in, &ev);
+	}
+	ev.data.u32 = 2;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+	catch_signals();
+	while (running) {
+		nev = epoll_wait(epfd, events, 3, -1);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
 			break;
+		}
+		for (k = 0; k < nev; k++) {
+			i = events[k].data.u32;
+			if (i < 2) {
+				bridge_forward(&dirs[i]);
+				continue;
+			}
+			if (read(tfd, &expired, sizeof(expired)) <= 0)
+				continue;
+			for (i = 0; i < 2; i++) {
+				fprintf(stderr, "%s: %llu frames/s, %llu drops%s",
+					dirs[i].name,
+					dirs[i].frames - dirs[i].last_frames,
+					dirs[i].drops, i ? "\n" : "; ");
+				dirs[i].last_frames = dirs[i].frames;
+			}
+		}
+	}
+	close(tfd);
+	close(epfd);
 
-		usleep(200 * u_to_m);
+	fprintf(stderr, "\n");
+	for (i = 0; i < 2; i++) {
+		fprintf(stderr, "%s: %llu frames, %llu rewritten, %llu drops\n",
+			dirs[i].name, dirs[i].frames, dirs[i].rewritten,
+			dirs[i].drops);
+		hist_show("latency", &dirs[i].lat);
 	}
-	return 0;
+	ret = 0;
+
+out:
+	free(dirs);
+	close(fd);
+
+	return ret;
 }
 
 
 /*****************************************************************************
-*** Function:    void read_port(const char *can_port)                      ***
+*** Function:    int open_isotp(const char *port, const char *ids,         ***
+***                             int swap)                                  ***
 ***                                                                        ***
-*** Parameters:  can_port: name of the can device                          ***
+*** Parameters:  port: name of the can device                              ***
+***              ids:  tx:rx IDs of the sender (hex) or NULL               ***
+***              swap: receiver, listen on tx and send flow control on rx  ***
 ***                                                                        ***
-*** Return:      -                                                         ***
+*** Return:      ISO-TP socket; -1: Failure                                ***
 ***                                                                        ***
 *** Description                                                            ***
 *** -----------                                                            ***
-*** This function reads out the CAN Frame and print it out in a endless    ***
-*** loop.                                                                  ***
+*** Open a CAN_ISOTP socket with the flow control parameters of -I. The    ***
+*** block size and STmin go into the flow control frames this socket       ***
+*** sends as receiver, the sender follows the values of its peer. With     ***
+*** padding, all frames are filled up to 8 bytes with the padding byte.    ***
+*** A write() only returns when the whole message has been sent, so the    ***
+*** sender can time each transfer.                                         ***
 *****************************************************************************/
-void read_port(const char *can_port) {
-	struct can_frame frame;
-	int nbytes, i;
+static int open_isotp(const char *port, const char *ids, int swap)
+{
+	struct sockaddr_can addr;
+	struct can_isotp_options opts;
+	struct can_isotp_fc_options fc;
+	struct can_isotp_ll_options ll;
+	unsigned long tx = DEFAULT_ISOTP_TX, rx = DEFAULT_ISOTP_RX;
+	const char *p;
+	char *end;
+	int fd;
 
-	printf("ID \t [DLC] \t data\n");
-	while(1) {
-		nbytes = read(soc, &frame, sizeof(struct can_frame));
-		if(nbytes > 0) {
-			printf("%s \t %03X \t [%d] \t", can_port, frame.can_id,
-								frame.can_dlc);
-			for(i=0; i<frame.can_dlc; i++)
-				printf("%02X ",frame.data[i]);
-			printf("\n");
+	if (ids) {
+		tx = strtoul(ids, &end, 16);
+		if ((end == ids) || (*end != ':') || (tx > CAN_EFF_MASK)) {
+			fprintf(stderr, "bad ISO-TP IDs\n");
+			return -1;
+		}
+		p = end + 1;
+		rx = strtoul(p, &end, 16);
+		if ((end == p) || *end || (rx > CAN_EFF_MASK)) {
+			fprintf(stderr, "bad ISO-TP IDs\n");
+			return -1;
+		}
+	}
+	if (tx > CAN_SFF_MASK)
+		tx = (tx & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	if (rx > CAN_SFF_MASK)
+		rx = (rx & CAN_EFF_MASK) | CAN_EFF_FLAG;
+
+	fd = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP);
+	if (fd < 0) {
+		perror("failed to open isotp socket (can-isotp loaded?)");
+		return -1;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = CAN_ISOTP_WAIT_TX_DONE;
+	if (isotp_pad >= 0) {
+		opts.flags |= CAN_ISOTP_TX_PADDING | CAN_ISOTP_RX_PADDING;
+		opts.txpad_content = isotp_pad;
+		opts.rxpad_content = isotp_pad;
+	}
+	memset(&fc, 0, sizeof(fc));
+	fc.bs = isotp_bs;
+	fc.stmin = isotp_stmin;
+	if ((setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts,
+			sizeof(opts)) < 0)
+	    || (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fc,
+			   sizeof(fc)) < 0)) {
+		perror("failed to set isotp options");
+		close(fd);
+		return -1;
+	}
+	if (fd_mode) {
+		memset(&ll, 0, sizeof(ll));
+		ll.mtu = CANFD_MTU;
+		ll.tx_dl = fd_round_len(fd_len);
+		ll.tx_flags = CANFD_BRS;
+		if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS, &ll,
+			       sizeof(ll)) < 0) {
+			perror("failed to set isotp FD options");
+			close(fd);
+			return -1;
+		}
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(port);
+	addr.can_addr.tp.tx_id = swap ? rx : tx;
+	addr.can_addr.tp.rx_id = swap ? tx : rx;
+	if (!addr.can_ifindex
+	    || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+		perror("failed to bind isotp socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*****************************************************************************
+*** Function:    int isotp_port(const char *port, char *arg, int sender)   ***
+***                                                                        ***
+*** Parameters:  port:   name of the can device                            ***
+***              arg:    tx:rx[:size] (hex IDs, size in bytes) or NULL     ***
+***              sender: 1: send messages; 0: receive them                 ***
+***                                                                        ***
+*** Return:      0: Success; 1: Failure                                    ***
+***                                                                        ***
+*** Description                                                            ***
+*** -----------                                                            ***
+*** Bulk transfer over ISO 15765-2. The sender writes -n messages of       ***
+*** <size> bytes (default DEFAULT_ISOTP_SIZE) and shows the time per       ***
+*** message. The receiver checks the contents until strg-c. Both show the  ***
+*** payload throughput once per second and at the end.                     ***
+*****************************************************************************/
+int isotp_port(const char *port, char *arg, int sender)
+{
+	unsigned long long msgs = 0, bytes = 0, last_bytes = 0, corrupt = 0;
+	unsigned long long first = 0;
+	unsigned long long total = count ? count : DEFAULT_ISOTP_MSGS;
+	unsigned long size = DEFAULT_ISOTP_SIZE;
+	uint64_t start = 0, end = 0, t, report;
+	struct hist *xfer;
+	uint8_t *buf;
+	char *p, *end_p;
+	ssize_t len;
+	int fd, i;
+
+	/* Optional message size after the IDs */
+	if (arg) {
+		p = strchr(arg, ':');
+		p = p ? strchr(p + 1, ':') : NULL;
+		if (p) {
+			*p++ = '\0';
+			size = strtoul(p, &end_p, 0);
+			if ((end_p == p) || *end_p)
+				size = 0;
+		}
+	}
+	if (!size || (size > ISOTP_MAX_SIZE)) {
+		fprintf(stderr, "message size must be 1..%d\n", ISOTP_MAX_SIZE);
+		return 1;
+	}
+
+	fd = open_isotp(port, arg, !sender);
+	if (fd < 0)
+		return 1;
+	buf = malloc(ISOTP_MAX_SIZE);
+	xfer = calloc(1, sizeof(*xfer));
+	if (!buf || !xfer) {
+		perror("failed to allocate buffer");
+		free(buf);
+		free(xfer);
+		close(fd);
+		return 1;
+	}
+	catch_signals();
+
+	report = now_ns() + 1000000000ULL;
+	while (running && (!sender || (msgs < total))) {
+		if (sender) {
+			/* Message number, then bytes counting up from it */
+			for (i = 0; i < (int)size; i++)
+				buf[i] = msgs + i;
+			t = now_ns();
+			len = write(fd, buf, size);
+			if (len != (ssize_t)size) {
+				if (errno == EMSGSIZE)
+					fprintf(stderr, "message size %lu is too "
+						"large for the ISO-TP socket\n",
+						size);
+				else if (errno != EINTR)
+					perror("failed to write isotp message");
+				break;
+			}
+		} else {
+			len = read(fd, buf, ISOTP_MAX_SIZE);
+			if (len < 0) {
+				if (errno != EINTR)
+					perror("failed to read isotp message");
+				break;
+			}
+			t = now_ns();
+			for (i = 1; i < len; i++) {
+				if (buf[i] != (uint8_t)(buf[0] + i)) {
+					corrupt++;
+					break;
+				}
+			}
+		}
+
+		/* The receiver only knows when a message was complete, so its
+		   throughput is measured from the end of the first message */
+		end = now_ns();
+		if (!start) {
+			start = sender ? t : end;
+			first = sender ? 0 : len;
+		}
+		if (sender)
+			hist_add(xfer, end - t);
+		msgs++;
+		bytes += len;
+
+		if (end >= report) {
+			fprintf(stderr, "isotp: %llu messages, %llu bytes/s\n",
+				msgs, bytes - last_bytes);
+			last_bytes = bytes;
+			report += 1000000000ULL;
 		}
 	}
+
+	fprintf(stderr, "\n%llu messages, %llu bytes", msgs, bytes);
+	if (!sender)
+		fprintf(stderr, ", %llu corrupt", corrupt);
+	if (end > start)
+		fprintf(stderr, ", %.0f bytes/s payload",
+			(double)(bytes - first) * 1e9
+			/ (end - start));
+	fprintf(stderr, "\n");
+	if (sender)
+		hist_show("transfer", xfer);
+	free(xfer);
+	free(buf);
+	close(fd);
+
+	return 0;
 }
 
 
@@ -170,11 +3551,25 @@ void read_port(const char *can_port) {
 ***                                                                        ***
 *** Description                                                            ***
 *** -----------                                                            ***
-*** This function close the can socket.                                    ***
+*** This function close all can sockets.                                   ***
 *****************************************************************************/
 void close_port()
 {
-	close(soc);
+	int i;
+
+	if (soc >= 0)
+		close(soc);
+	if (any_fd >= 0)
+		close(any_fd);
+	for (i = 0; i < nifs; i++) {
+		if (ifs[i].fd >= 0)
+			close(ifs[i].fd);
+		if (ifs[i].ring) {
+			munmap(ifs[i].ring->map, ifs[i].ring->size);
+			free(ifs[i].ring);
+		}
+		free(ifs[i].ids);
+	}
 }
 
 
@@ -192,19 +3587,100 @@ void close_port()
 void usage(const char *progname)
 {
 	printf("\n"
-	       "Usage: %s <mode> <can_port> [flag]\n"
+	       "Usage: %s [options] <mode> <can_port> [flag]\n"
 	       "\n"
-	       "  directon: set can mode: \"read\" or \"write\"\n"
-	       "  can_nr:   can port that will be used (e.g. can0)\n"
+	       "  directon: set can mode: \"read\", \"write\", \"flood\", "
+			    "\"stats\", \"capture\", \"replay\", \"cyclic\", "
+			    "\"ping\", \"pong\", \"bridge\", \"isotp-send\" "
+			    "or \"isotp-recv\"\n"
+	       "  can_nr:   can port that will be used (e.g. can0); read, "
+			    "stats and capture also take a list (can0,can1) or "
+			    "\"any\" for all ports; bridge takes two ports "
+			    "(can0,can1)\n"
 	       "  flag:     \"SEND_ONCE\" for sending one frame, "
 			    "\"SEND_START\" for sending several frames. "
 			    "default is SEND_ONCE\n"
+	       "            capture and replay: name of the capture file\n"
+	       "            cyclic: jobs id:period[:data],... (hex ID and "
+			    "data, period in ms)\n"
+	       "            ping and pong: ping ID (hex, default 0x%X), the "
+			    "pong answers on ID + 1\n"
+	       "            bridge: ID rewrite rules from=to,... (hex)\n"
+	       "            isotp-send and isotp-recv: tx:rx[:size], IDs of "
+			    "the sender (hex, default %X:%X), message size "
+			    "(default %d, max. %d)\n"
+	       "\n"
+	       "options:\n"
+	       "  -b batch: frames per recvmmsg()/sendmmsg() call (1..%d, "
+			    "default %d)\n"
+	       "  -q:       quiet, do not print frames, only the rates\n"
+	       "  -T:       read with one thread per port, pinned to a CPU "
+			    "(not with \"any\")\n"
+	       "  -r rate:  frames/s in flood mode, pings/s or \"max\" "
+			    "(default max)\n"
+	       "  -n count: number of frames in flood mode (default endless), "
+			    "pings (default %d) or ISO-TP messages (default "
+			    "%d)\n"
+	       "  -s:       sequence test: write and flood send numbered "
+			    "frames, read checks them for lost, duplicate, "
+			    "reordered and corrupt frames per ID\n"
+	       "  -i id[-id]: ID or ID range for sequence test frames "
+			    "(default 0x%X)\n"
+	       "  -F:       use CAN FD frames with bit rate switch; read "
+			    "accepts classic and FD frames\n"
+	       "  -l len:   payload length of FD frames (0..64, default "
+			    "%d, at least 8 with -s and ISO-TP)\n"
+	       "  -S size:  size of the capture file in MB (default %d, "
+			    "max. %lu)\n"
+	       "  -u:       cyclic mode sends from a user space loop instead "
+			    "of the kernel broadcast manager\n"
+	       "  -p prio:  run with SCHED_FIFO priority prio (1..99, ping "
+			    "and pong)\n"
+	       "  -c cpu:   pin to cpu (0..number of CPUs - 1, ping and "
+			    "pong)\n"
+	       "  -B rate[:ms]: size the receive buffer for <ms> (default "
+			    "%d) of frames at <rate> frames/s\n"
+	       "  -I bs[:stmin[:pad]]: ISO-TP block size, STmin in us (100..900 "
+			    "or multiples of 1000 up to 127000) and padding "
+			    "byte (hex)\n"
+	       "  -M:       read, stats and capture receive from a mapped "
+			    "TPACKET_V3 packet ring instead of a raw socket "
+			    "(no -f)\n"
+	       "  -H:       request hardware receive time stamps from the "
+			    "driver\n"
+	       "  -L:       read collects inter-arrival and kernel to user "
+			    "latency histograms instead of printing frames\n"
+	       "  -f filters: comma separated receive filters (hex), "
+			    "installed in the kernel:\n"
+	       "            id:mask  accept if id & mask matches\n"
+	       "            id~mask  accept if id & mask does not match\n"
+	       "            #mask    accept error frames of classes in "
+			    "mask\n"
+	       "\n"
+	       "The stats mode reads like the read mode, but only shows a "
+	       "table of all received IDs once per second.\n"
+	       "The capture mode writes binary records to a memory mapped "
+	       "ring file, replay sends them with the original timing "
+	       "(or with \"-r max\" as fast as possible).\n"
+	       "The cyclic mode lets the kernel send periodic frames and "
+	       "measures their period jitter until strg-c.\n"
+	       "The ping mode measures round trip times against a pong "
+	       "process, e.g. in a second shell on vcan0.\n"
+	       "The bridge mode forwards frames between two ports in both "
+	       "directions; -f filters apply to both ports.\n"
+	       "The flood mode sends random frames in batches of <batch> "
+	       "frames to load the bus. It can be tested on a virtual "
+	       "interface (\"ip link add dev vcan0 type vcan; ip link set "
+	       "vcan0 up\").\n"
 	       "\n"
 	       "you only have the flag option if the mode is set to write. "
 	       "You can break up the SEND_START or the read mode with strg-c."
 	       "Be sure that you have activated the CAN interface. (\"ip link "
 	       "set can0 up type can bitrate 125000\"\n"
-	       "\n", progname);
+	       "\n", progname, DEFAULT_PING_ID, DEFAULT_ISOTP_TX,
+	       DEFAULT_ISOTP_RX, DEFAULT_ISOTP_SIZE, ISOTP_MAX_SIZE, MAX_BATCH,
+	       DEFAULT_BATCH, DEFAULT_PINGS, DEFAULT_ISOTP_MSGS, DEFAULT_SEQ_ID,
+	       CANFD_MAX_DLEN, DEFAULT_CAP_MB, MAX_CAP_MB, DEFAULT_RCVBUF_MS);
 }
 
 
@@ -221,36 +3697,243 @@ void usage(const char *progname)
 *** Parse the command line options and call the necessary functions to     ***
 *** use CAN                                                               ***
 *****************************************************************************/
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
-	const char *can_port = NULL;
+	const char *mode;
+	char *can_port;
+	char *peer = NULL;
+	char *flag = NULL;
+	char *end;
 	int send_start = 0;
 	int ret;
+	int opt;
 
-	if ((argc < 3) || (argc > 4)) {
+	while ((opt = getopt(argc, argv, "b:qTr:n:si:f:Fl:HLS:up:c:B:I:M")) != -1) {
+		switch (opt) {
+		case 'b':
+			batch = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end || (batch < 1)
+			    || (batch > MAX_BATCH)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'T':
+			threads = 1;
+			break;
+		case 'r':
+			if (strcmp(optarg, "max") == 0) {
+				rate = 0;
+				rate_max = 1;
+			} else {
+				/* 0 would silently mean max, that is "max" */
+				rate = strtoul(optarg, &end, 0);
+				if ((end == optarg) || *end || !rate) {
+					usage(argv[0]);
+					return 1;
+				}
+			}
+			break;
+		case 'n':
+			count = strtoull(optarg, &end, 0);
+			if ((end == optarg) || *end) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			seq_mode = 1;
+			break;
+		case 'i':
+			seq_id_first = strtoul(optarg, &end, 0);
+			seq_id_last = seq_id_first;
+			if (*end == '-')
+				seq_id_last = strtoul(end + 1, &end, 0);
+			if (*end || (seq_id_last < seq_id_first)
+			    || (seq_id_last > CAN_EFF_MASK)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'F':
+			fd_mode = 1;
+			break;
+		case 'S':
+			cap_mb = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end || !cap_mb
+			    || (cap_mb > MAX_CAP_MB)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'u':
+			user_loop = 1;
+			break;
+		case 'p':
+			rt_prio = strtol(optarg, &end, 0);
+			if ((end == optarg) || *end
+			    || (rt_prio < sched_get_priority_min(SCHED_FIFO))
+			    || (rt_prio > sched_get_priority_max(SCHED_FIFO))) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			rt_cpu = strtol(optarg, &end, 0);
+			if ((end == optarg) || *end || (rt_cpu < 0)
+			    || (rt_cpu >= sysconf(_SC_NPROCESSORS_CONF))
+			    || (rt_cpu >= CPU_SETSIZE)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'B':
+			rcvbuf_rate = strtoul(optarg, &end, 0);
+			if (*end == ':')
+				rcvbuf_ms = strtoul(end + 1, &end, 0);
+			if (*end || !rcvbuf_rate || !rcvbuf_ms) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'I':
+			if (parse_isotp_opts(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'M':
+			ring_mode = 1;
+			break;
+		case 'H':
+			hw_stamps = 1;
+			break;
+		case 'L':
+			lat_mode = 1;
+			break;
+		case 'l':
+			fd_len = strtoul(optarg, &end, 0);
+			if ((end == optarg) || *end
+			    || (fd_len > CANFD_MAX_DLEN)) {
+				usage(argv[0]);
+				return 1;
+			}
+			fd_len = fd_round_len(fd_len);
+			break;
+		case 'f':
+			if (parse_filters(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((argc - optind < 2) || (argc - optind > 3)) {
 		usage(argv[0]);
 		return 1;
 	}
-
-	can_port = argv[2];
-	if(can_port == NULL) {
-		usage(argv[0]);
+	if (seq_mode && fd_mode && (fd_len < 8)) {
+		/* No room for the sequence number and the first check word */
+		fprintf(stderr, "-s needs FD frames of at least 8 bytes\n");
+		return 1;
+	}
+	mode = argv[optind];
+	if ((strncmp(mode, "isotp-", 6) == 0) && fd_mode && (fd_len < 8)) {
+		/* ISO 15765-2 only allows TX_DL 8, 12, ..., 64 */
+		fprintf(stderr, "ISO-TP needs FD frames of at least 8 bytes\n");
 		return 1;
 	}
+	if (strcmp(mode, "stats") == 0) {
+		/* Read mode that only counts */
+		stats_mode = 1;
+		mode = "read";
+	}
+	can_port = argv[optind + 1];
+	if (argc - optind > 2)
+		flag = argv[optind + 2];
 
-	ret = open_port(can_port);
+	if ((strcmp(mode, "capture") == 0) || (strcmp(mode, "replay") == 0)
+	    || (strcmp(mode, "cyclic") == 0)) {
+		if (!flag) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (strcmp(mode, "bridge") == 0) {
+		peer = strchr(can_port, ',');
+		if (!peer) {
+			usage(argv[0]);
+			return 1;
+		}
+		*peer++ = '\0';
+	}
+	if ((strcmp(mode, "read") == 0) || (strcmp(mode, "capture") == 0))
+		ret = open_ports(can_port);
+	else
+		ret = open_port(can_port);
 	if(ret)
 		return 1;
 
-	if (strcmp((argv[1]),"read")==0)
-		read_port(can_port);
-	else if (strcmp((argv[1]),"write")==0) {
-		if((argc > 3) && (strcmp((argv[3]),"SEND_START") == 0))
+	if ((strcmp(mode, "read") == 0) || (strcmp(mode, "capture") == 0)) {
+		if (threads && (any_fd >= 0)) {
+			fprintf(stderr, "thread mode needs a list of ports\n");
+			return 1;
+		}
+		if ((strcmp(mode, "capture") == 0) && open_capture(flag))
+			return 1;
+		read_port();
+		close_capture();
+	}
+	else if (strcmp(mode, "write") == 0) {
+		if (flag && (strcmp(flag, "SEND_START") == 0))
 			send_start = 1;
 		ret = send_port(send_start);
 		if(ret)
 			return 1;
 	}
+	else if (strcmp(mode, "flood") == 0) {
+		ret = flood_port();
+		if (ret)
+			return 1;
+	}
+	else if (strcmp(mode, "replay") == 0) {
+		ret = replay_port(flag);
+		if (ret)
+			return 1;
+	}
+	else if (strcmp(mode, "cyclic") == 0) {
+		ret = cyclic_port(can_port, flag);
+		if (ret)
+			return 1;
+	}
+	else if (strcmp(mode, "ping") == 0) {
+		ret = ping_port(flag);
+		if (ret)
+			return 1;
+	}
+	else if (strcmp(mode, "pong") == 0) {
+		ret = pong_port(flag);
+		if (ret)
+			return 1;
+	}
+	else if (strcmp(mode, "bridge") == 0) {
+		ret = bridge_port(can_port, peer, flag);
+		if (ret)
+			return 1;
+	}
+	else if ((strcmp(mode, "isotp-send") == 0)
+		 || (strcmp(mode, "isotp-recv") == 0)) {
+		ret = isotp_port(can_port, flag,
+				 strcmp(mode, "isotp-send") == 0);
+		if (ret)
+			return 1;
+	}
 	else {
 		usage(argv[0]);
 		return 1;